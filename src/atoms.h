@@ -4,10 +4,38 @@
 #include <ios>
 #include <fstream>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <type_traits>
+
+#ifndef _WIN32
+	#include <cerrno>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#define MATTER_HAS_MMAP
+#endif
 
 #include "matterDefines.h"
 #include "coerce.h"
 #include "drle.h"
+#include "cache.h"
+#include "compress.h"
+#include "handles.h"
+#include "threads.h"
+
+// bytes to accumulate before dropping pages (direct mode)
+#define DROP_WINDOW 4194304
+
+// read coalescing for scattered indices
+#define COALESCE_RUNLEN		16 // coalesce if mean run is shorter
+#define COALESCE_MAXREAD	262144 // max elements per coalesced read
+#define READS_MERGEBYTES	65536 // only merge queued reads smaller than this
+#define READS_MAXMERGE		4194304 // max bytes per merged read
+#define READS_MAXGAP		4096 // max bytes to read through when merging
+#define READS_MINGATHER		8 // min segments worth gathering without threads
 
 //// DataSources class
 //---------------------
@@ -31,6 +59,9 @@ class DataSources {
 				_mode = std::ios::in | std::ios::binary;
 			else
 				_mode = std::ios::in | std::ios::out | std::ios::binary;
+			_iomode = get_iomode(Rf_getAttrib(x, Rf_install("iomode")));
+			init_cache();
+			init_handles();
 			init_streams();
 		}
 
@@ -38,6 +69,56 @@ class DataSources {
 			exit_streams();
 		}
 
+		// resolve i/o mode (NA means use global option)
+		static int get_iomode(SEXP mode)
+		{
+			int code = NA_INTEGER;
+			if ( !Rf_isNull(mode) && LENGTH(mode) > 0 )
+				code = Rf_asInteger(mode);
+			if ( isNA(code) ) {
+				SEXP opt = Rf_GetOption1(Rf_install("matter.default.iomode"));
+				if ( Rf_isString(opt) && LENGTH(opt) > 0 ) {
+					if ( strcmp(CHAR(STRING_ELT(opt, 0)), "mmap") == 0 )
+						code = IO_MMAP;
+					else if ( strcmp(CHAR(STRING_ELT(opt, 0)), "direct") == 0 )
+						code = IO_DIRECT;
+				}
+			}
+			return isNA(code) ? IO_STREAM : code;
+		}
+
+		// configure the shared block cache from options
+		void init_cache()
+		{
+			double capacity = 0;
+			int policy = CACHE_LRU;
+			SEXP size = Rf_GetOption1(Rf_install("matter.cache.size"));
+			SEXP type = Rf_GetOption1(Rf_install("matter.cache.policy"));
+			if ( Rf_isNumeric(size) && LENGTH(size) > 0 )
+				capacity = Rf_asReal(size);
+			if ( Rf_isString(type) && LENGTH(type) > 0 ) {
+				if ( strcmp(CHAR(STRING_ELT(type, 0)), "clock") == 0 )
+					policy = CACHE_CLOCK;
+			}
+			if ( isNA(capacity) )
+				capacity = 0;
+			block_cache().configure(capacity, policy);
+			if ( block_cache().enabled() && _iomode != IO_DIRECT )
+				_cache = &block_cache();
+		}
+
+		// configure the shared handle pool from options
+		void init_handles()
+		{
+			int maxopen = HANDLES_MAXOPEN;
+			SEXP opt = Rf_GetOption1(Rf_install("matter.io.handles"));
+			if ( Rf_isNumeric(opt) && LENGTH(opt) > 0 )
+				maxopen = Rf_asInteger(opt);
+			if ( isNA(maxopen) )
+				maxopen = 0;
+			handle_pool().configure(maxopen);
+		}
+
 		void init_streams()
 		{
 			if ( _streams == NULL ) {
@@ -45,6 +126,16 @@ class DataSources {
 				for ( int i = 0; i < _length; i++ )
 					_streams[i] = NULL;
 			}
+			if ( _maps == NULL && _iomode == IO_MMAP ) {
+				_maps = (MappedFile *) R_Calloc(_length, MappedFile);
+				for ( int i = 0; i < _length; i++ )
+					_maps[i] = {NULL, 0, false};
+			}
+			if ( _fileids == NULL && _cache != NULL ) {
+				_fileids = (int *) R_Calloc(_length, int);
+				for ( int i = 0; i < _length; i++ )
+					_fileids[i] = -1;
+			}
 			_current = 0;
 		}
 
@@ -53,19 +144,89 @@ class DataSources {
 			if ( _streams != NULL ) {
 				for ( int i = 0; i < _length; i++ )
 					if ( _streams[i] != NULL ) {
-						_streams[i]->close();
-						delete _streams[i];
+						handle_pool().release(_streams[i]);
 						_streams[i] = NULL;
 					}
+				Free(_streams);
+			}
+			if ( _maps != NULL ) {
+				for ( int i = 0; i < _length; i++ )
+					unmap(i);
+				Free(_maps);
+			}
+			if ( _fileids != NULL )
+				Free(_fileids);
+			if ( _zsrc != NULL ) {
+				for ( int i = 0; i < _length; i++ )
+					if ( _zsrc[i] != NULL ) {
+						delete _zsrc[i];
+						_zsrc[i] = NULL;
+					}
+				Free(_zsrc);
+			}
+			if ( _dropped != NULL ) {
+				for ( int i = 0; i < _length; i++ )
+					drop_pages(i);
+				Free(_dropped);
+			}
+			if ( _fds != NULL ) {
+				for ( int i = 0; i < _length; i++ )
+					if ( _fds[i] >= 0 )
+						handle_pool().release_fd(_fds[i]);
+				Free(_fds);
+			}
+		}
+
+		// note bytes that were read so the os can drop them
+		// from its page cache (used by direct mode scans)
+		void consumed(int src, index_t off, size_t nbytes)
+		{
+			if ( _iomode != IO_DIRECT || nbytes == 0 )
+				return;
+			if ( _dropped == NULL ) {
+				_dropped = (ByteRange *) R_Calloc(_length, ByteRange);
+				for ( int i = 0; i < _length; i++ )
+					_dropped[i] = {0, 0};
+			}
+			ByteRange * r = &_dropped[src];
+			index_t end = off + nbytes;
+			if ( r->start == r->end ) {
+				r->start = off;
+				r->end = end;
 			}
-			_streams = NULL;
-			Free(_streams);
+			else {
+				r->start = off < r->start ? off : r->start;
+				r->end = end > r->end ? end : r->end;
+			}
+			if ( r->end - r->start >= DROP_WINDOW )
+				drop_pages(src);
+		}
+
+		// advise the os that consumed bytes aren't needed
+		void drop_pages(int src)
+		{
+			ByteRange * r = &_dropped[src];
+			if ( r->start == r->end )
+				return;
+		#if defined(MATTER_HAS_MMAP) && defined(POSIX_FADV_DONTNEED)
+			int fd = _fds != NULL ? _fds[src] : -1;
+			if ( fd < 0 )
+				fd = descriptor(src);
+			if ( fd >= 0 )
+				posix_fadvise(fd, r->start, r->end - r->start, POSIX_FADV_DONTNEED);
+		#endif
+			r->start = 0;
+			r->end = 0;
 		}
 
 		bool readonly() {
 			return _readonly;
 		}
 
+		int iomode() {
+			return _iomode;
+		}
+
 		SEXP path(int src) {
 			return STRING_ELT(_paths, src);
 		}
@@ -74,13 +235,64 @@ class DataSources {
 			return _length;
 		}
 
+		bool cached() {
+			return _cache != NULL;
+		}
+
+		void flush()
+		{
+			if ( _streams == NULL )
+				return;
+			for ( int i = 0; i < _length; i++ )
+				if ( _streams[i] != NULL )
+					_streams[i]->flush();
+		}
+
+		// descriptor for positioned reads (-1 if unavailable)
+		// (must be acquired on the main thread)
+		int descriptor(int src)
+		{
+		#ifdef MATTER_HAS_MMAP
+			if ( _fds == NULL ) {
+				_fds = (int *) R_Calloc(_length, int);
+				for ( int i = 0; i < _length; i++ )
+					_fds[i] = -1;
+			}
+			if ( _fds[src] < 0 )
+				_fds[src] = handle_pool().acquire_fd(CHAR(path(src)));
+			return _fds[src];
+		#else
+			return -1;
+		#endif
+		}
+
+		// read bytes at an offset without moving any stream
+		// (safe to call from worker threads)
+		static bool pread_all(int fd, char * ptr, size_t nbytes, index_t off)
+		{
+		#ifdef MATTER_HAS_MMAP
+			size_t done = 0;
+			while ( done < nbytes )
+			{
+				ssize_t n = pread(fd, ptr + done, nbytes - done, off + done);
+				if ( n < 0 && errno == EINTR )
+					continue;
+				if ( n <= 0 )
+					return false;
+				done += n;
+			}
+			return true;
+		#else
+			return false;
+		#endif
+		}
+
 		std::fstream * select(int src)
 		{
 			if ( _streams[src] == NULL ) {
 				const char * filename = CHAR(path(src));
-				_streams[src] = new std::fstream();
-				_streams[src]->open(filename, _mode);
-				if ( !_streams[src]->is_open() ) {
+				_streams[src] = handle_pool().acquire(filename, _mode);
+				if ( _streams[src] == NULL ) {
 					exit_streams();
 					Rf_error("could not open file '%s'", filename);
 				}
@@ -89,23 +301,308 @@ class DataSources {
 			return _streams[_current];
 		}
 
+		// map a source into memory (returns false if mapping fails)
+		bool map(int src)
+		{
+		#ifdef MATTER_HAS_MMAP
+			unmap(src);
+			_maps[src].tried = true;
+			const char * filename = CHAR(path(src));
+			int fd = _readonly ? descriptor(src) : open(filename, O_RDWR);
+			if ( fd < 0 )
+				return false;
+			struct stat info;
+			int prot = _readonly ? PROT_READ : (PROT_READ | PROT_WRITE);
+			void * addr = MAP_FAILED;
+			if ( fstat(fd, &info) == 0 && info.st_size > 0 )
+				addr = mmap(NULL, info.st_size, prot, MAP_SHARED, fd, 0);
+			if ( !_readonly )
+				close(fd); // mapping stays valid after closing
+			if ( addr == MAP_FAILED )
+				return false;
+			_maps[src].addr = static_cast<char *>(addr);
+			_maps[src].size = static_cast<size_t>(info.st_size);
+			return true;
+		#else
+			return false;
+		#endif
+		}
+
+		void unmap(int src)
+		{
+		#ifdef MATTER_HAS_MMAP
+			if ( _maps[src].addr != NULL )
+				munmap(_maps[src].addr, _maps[src].size);
+		#endif
+			_maps[src].addr = NULL;
+			_maps[src].size = 0;
+		}
+
+		// get pointer to mapped bytes [off, off + nbytes) or NULL
+		// (if 'remap' then a grown file is mapped again, which
+		// invalidates any pointers returned before)
+		char * mapped(int src, index_t off, size_t nbytes, bool remap = true)
+		{
+			if ( _maps == NULL || off < 0 || compressed(src) )
+				return NULL;
+			MappedFile * mf = &_maps[src];
+			if ( !mf->tried )
+				map(src);
+			if ( mf->addr != NULL && off + nbytes <= mf->size )
+				return mf->addr + off;
+			// file may have grown since it was mapped
+			if ( remap && mf->addr != NULL && map(src) && off + nbytes <= mf->size )
+				return mf->addr + off;
+			return NULL;
+		}
+
+		// hint that bytes [off, off + nbytes) will be read soon
+		// (the os loads them in the background; failures are ignored)
+		void prefetch(int src, index_t off, size_t nbytes)
+		{
+			if ( off < 0 || nbytes == 0 )
+				return;
+			if ( compressed(src) )
+			{
+				// prefetch the compressed blocks instead
+				ZSource * z = _zsrc[src];
+				uint64_t bs = z->header.blocksize;
+				uint64_t b0 = off / bs;
+				uint64_t b1 = (off + nbytes - 1) / bs;
+				if ( b0 >= z->header.nblocks )
+					return;
+				if ( b1 >= z->header.nblocks )
+					b1 = z->header.nblocks - 1;
+				off = z->offsets[b0];
+				nbytes = z->offsets[b1 + 1] - z->offsets[b0];
+			}
+		#ifdef MATTER_HAS_MMAP
+			char * addr = mapped(src, off, nbytes);
+			if ( addr != NULL ) {
+				size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+				size_t skip = reinterpret_cast<uintptr_t>(addr) % pagesize;
+				madvise(addr - skip, nbytes + skip, MADV_WILLNEED);
+				return;
+			}
+			int fd = descriptor(src);
+			if ( fd < 0 )
+				return;
+			#if defined(POSIX_FADV_WILLNEED)
+				posix_fadvise(fd, off, nbytes, POSIX_FADV_WILLNEED);
+			#elif defined(F_RDADVISE)
+				struct radvisory ra;
+				ra.ra_offset = off;
+				ra.ra_count = static_cast<int>(min2(nbytes, static_cast<size_t>(INT_MAX)));
+				fcntl(fd, F_RDADVISE, &ra);
+			#endif
+		#endif
+		}
+
+		// is a source block-compressed? (header read on first use)
+		bool compressed(int src)
+		{
+			if ( _iomode != IO_COMPRESSED )
+				return false;
+			if ( _zsrc == NULL ) {
+				_zsrc = (ZSource **) R_Calloc(_length, ZSource*);
+				for ( int i = 0; i < _length; i++ )
+					_zsrc[i] = NULL;
+			}
+			if ( _zsrc[src] == NULL )
+			{
+				ZSource * z = new ZSource();
+				z->compressed = false;
+				z->current = -1;
+				_zsrc[src] = z;
+				std::fstream * stream = select(src);
+				std::streampos pos = stream->tellg();
+				char magic[ZFILE_MAGICLEN];
+				stream->seekg(0, std::ios::beg);
+				stream->read(magic, ZFILE_MAGICLEN);
+				if ( stream->fail() ||
+					std::memcmp(magic, ZFILE_MAGIC, ZFILE_MAGICLEN) != 0 )
+				{
+					const char * filename = CHAR(path(src));
+					exit_streams();
+					Rf_error("'%s' is not a compressed file", filename);
+				}
+				stream->read(reinterpret_cast<char*>(&z->header), sizeof(ZHeader));
+				if ( !stream->fail() ) {
+					z->offsets.resize(z->header.nblocks + 1);
+					stream->read(reinterpret_cast<char*>(z->offsets.data()),
+						sizeof(uint64_t) * z->offsets.size());
+				}
+				if ( stream->fail() || z->header.blocksize == 0 ) {
+					const char * filename = CHAR(path(src));
+					exit_streams();
+					Rf_error("corrupt compressed file '%s'", filename);
+				}
+				z->compressed = true;
+				stream->clear();
+				if ( pos >= 0 )
+					stream->seekg(pos, std::ios::beg);
+			}
+			return _zsrc[src]->compressed;
+		}
+
+		// get a decompressed block (or NULL if it can't be read)
+		const char * zblock(int src, uint64_t b, size_t * len)
+		{
+			ZSource * z = _zsrc[src];
+			uint64_t bs = z->header.blocksize;
+			uint64_t start = b * bs;
+			*len = static_cast<size_t>(min2(bs, z->header.size - start));
+			bool shared = _cache != NULL && bs == CACHE_BLOCKSIZE;
+			if ( shared ) {
+				BlockCache::Block * cb = _cache->find(file_id(src), start);
+				if ( cb != NULL )
+					return cb->data.data();
+			}
+			if ( z->current != static_cast<index_t>(b) )
+			{
+				z->current = -1;
+				size_t nbytes = z->offsets[b + 1] - z->offsets[b];
+				std::vector<char> encoded(nbytes);
+				std::fstream * stream = select(src);
+				stream->seekg(z->offsets[b], std::ios::beg);
+				stream->read(encoded.data(), nbytes);
+				if ( stream->fail() ) {
+					stream->clear();
+					return NULL;
+				}
+				consumed(src, z->offsets[b], nbytes);
+				z->block.resize(*len);
+				if ( !zblock_decode(encoded.data(), nbytes, z->block.data(),
+					*len, z->header.width) )
+				{
+					return NULL;
+				}
+				z->current = b;
+			}
+			if ( shared )
+				_cache->insert(file_id(src), start, z->block.data(), *len);
+			return z->block.data();
+		}
+
+		// read through decompressed blocks
+		bool read_compressed(char * ptr, size_t nbytes)
+		{
+			ZSource * z = _zsrc[_current];
+			uint64_t bs = z->header.blocksize;
+			while ( nbytes > 0 )
+			{
+				if ( _pos < 0 || static_cast<uint64_t>(_pos) >= z->header.size )
+					return false;
+				uint64_t b = _pos / bs;
+				size_t len;
+				const char * data = zblock(_current, b, &len);
+				if ( data == NULL )
+					return false;
+				size_t i = _pos - b * bs;
+				size_t n = min2(nbytes, len - i);
+				std::memcpy(ptr, data + i, n);
+				ptr += n;
+				_pos += n;
+				nbytes -= n;
+			}
+			return true;
+		}
+
+		// id of source in the block cache
+		int file_id(int src)
+		{
+			if ( _fileids[src] < 0 )
+				_fileids[src] = _cache->file_id(CHAR(path(src)));
+			return _fileids[src];
+		}
+
+		// drop cached blocks that are about to be overwritten
+		// (even if this source doesn't read through the cache,
+		// e.g., in direct mode, the cache may hold its blocks)
+		void invalidate(int src, index_t off, size_t nbytes)
+		{
+			if ( _cache != NULL )
+				_cache->invalidate(file_id(src), off, nbytes);
+			else if ( block_cache().nblocks() > 0 ) {
+				int id = block_cache().find_file(CHAR(path(src)));
+				if ( id >= 0 )
+					block_cache().invalidate(id, off, nbytes);
+			}
+		}
+
+		// read through the block cache
+		bool read_cached(char * ptr, size_t nbytes)
+		{
+			int id = file_id(_current);
+			char * buffer = NULL;
+			while ( nbytes > 0 )
+			{
+				index_t start = _pos - (_pos % CACHE_BLOCKSIZE);
+				BlockCache::Block * b = _cache->find(id, start);
+				if ( b == NULL ) {
+					if ( buffer == NULL )
+						buffer = (char *) R_Calloc(CACHE_BLOCKSIZE, char);
+					std::fstream * stream = select(_current);
+					stream->seekg(start, std::ios::beg);
+					stream->read(buffer, CACHE_BLOCKSIZE);
+					size_t n = stream->gcount();
+					stream->clear(); // allow short read at eof
+					b = _cache->insert(id, start, buffer, n);
+				}
+				size_t i = _pos - start;
+				if ( i >= b->data.size() )
+					break;
+				size_t n = min2(nbytes, b->data.size() - i);
+				std::memcpy(ptr, b->data.data() + i, n);
+				ptr += n;
+				_pos += n;
+				nbytes -= n;
+			}
+			if ( buffer != NULL )
+				Free(buffer);
+			return nbytes == 0;
+		}
+
 		DataSources * rseek(int src, index_t off = 0)
 		{
-			select(src)->seekg(off, std::ios::beg);
+			_current = src;
+			_pos = off;
+			if ( _maps == NULL && _cache == NULL )
+				select(src)->seekg(off, std::ios::beg);
 			return this;
 		}
 
 		DataSources * wseek(int src, index_t off = 0)
 		{
-			select(src)->seekp(off, std::ios::beg);
+			_current = src;
+			_pos = off;
+			if ( _maps == NULL )
+				select(src)->seekp(off, std::ios::beg);
 			return this;
 		}
 
 		template<typename T>
 		bool read(void * ptr, size_t size)
 		{
+			size_t nbytes = sizeof(T) * size;
+			if ( compressed(_current) )
+				return read_compressed(reinterpret_cast<char*>(ptr), nbytes);
+			if ( _maps != NULL ) {
+				char * src = mapped(_current, _pos, nbytes);
+				if ( src != NULL ) {
+					std::memcpy(ptr, src, nbytes);
+					_pos += nbytes;
+					return true;
+				}
+			}
+			if ( _cache != NULL )
+				return read_cached(reinterpret_cast<char*>(ptr), nbytes);
+			if ( _maps != NULL )
+				select(_current)->seekg(_pos, std::ios::beg);
 			std::fstream * stream = _streams[_current];
-			stream->read(reinterpret_cast<char*>(ptr), sizeof(T) * size);
+			stream->read(reinterpret_cast<char*>(ptr), nbytes);
+			consumed(_current, _pos, nbytes);
+			_pos += nbytes;
 			return !stream->fail();
 		}
 
@@ -116,17 +613,63 @@ class DataSources {
 				exit_streams();
 				Rf_error("storage mode is read-only");
 			}
+			if ( compressed(_current) ) {
+				exit_streams();
+				Rf_error("compressed data sources are read-only");
+			}
+			size_t nbytes = sizeof(T) * size;
+			if ( _maps != NULL ) {
+				char * dest = mapped(_current, _pos, nbytes);
+				if ( dest != NULL ) {
+					invalidate(_current, _pos, nbytes);
+					std::memcpy(dest, ptr, nbytes);
+					_pos += nbytes;
+					return true;
+				}
+				select(_current)->seekp(_pos, std::ios::beg);
+			}
+			invalidate(_current, _pos, nbytes);
 			std::fstream * stream = _streams[_current];
-			stream->write(reinterpret_cast<char*>(ptr), sizeof(T) * size);
+			stream->write(reinterpret_cast<char*>(ptr), nbytes);
+			_pos += nbytes;
+			if ( _maps != NULL )
+				stream->flush(); // keep visible to the mapping
 			return !stream->fail();
 		}
 
 	protected:
 
+		struct MappedFile {
+			char * addr;
+			size_t size;
+			bool tried;
+		};
+
+		struct ByteRange {
+			index_t start;
+			index_t end;
+		};
+
+		struct ZSource {
+			bool compressed;
+			ZHeader header;
+			std::vector<uint64_t> offsets; // compressed block offsets
+			std::vector<char> block; // last decompressed block
+			index_t current; // index of last block (or -1)
+		};
+
 		SEXP _paths;
 		bool _readonly;
+		int _iomode;
 		std::ios::openmode _mode;
 		std::fstream ** _streams = NULL;
+		MappedFile * _maps = NULL;
+		BlockCache * _cache = NULL;
+		int * _fileids = NULL;
+		int * _fds = NULL;
+		ByteRange * _dropped = NULL;
+		ZSource ** _zsrc = NULL;
+		index_t _pos = 0;
 		int _current;
 		int _length;
 
@@ -140,6 +683,45 @@ struct AtomInfo {
 	index_t pos;
 };
 
+//// Struct for queued reads
+//---------------------------
+
+struct ReadTask {
+	int source;
+	index_t offset;
+	size_t nbytes;
+	char * mapped; // mapped bytes (or NULL)
+	char * dest; // output buffer
+	size_t raw; // position in raw buffer
+	size_t size; // number of elements
+	int stride;
+	bool direct; // read straight into dest?
+	void (*finish)(const ReadTask &, const char *);
+};
+
+// a single read covering one or more adjacent tasks
+struct ReadRun {
+	int source;
+	index_t offset;
+	size_t nbytes;
+	char * mapped; // mapped bytes (or NULL)
+	size_t first, last; // range of tasks
+	size_t raw; // position in raw buffer
+	bool direct; // read straight into the (only) task's dest?
+};
+
+// coerce raw bytes of a queued read into its output
+template<typename Tin, typename Tout>
+void finish_read(const ReadTask & task, const char * raw)
+{
+	Tout * ptr = reinterpret_cast<Tout *>(task.dest);
+	Tin val;
+	for ( size_t i = 0; i < task.size; i++ ) {
+		std::memcpy(&val, raw + sizeof(Tin) * i, sizeof(Tin));
+		ptr[task.stride * i] = coerce_cast<Tout>(val);
+	}
+}
+
 //// Atoms class
 //----------------
 
@@ -153,14 +735,34 @@ class Atoms {
 			_offsets(R_do_slot(x, Rf_install("offset"))),
 			_extents(R_do_slot(x, Rf_install("extent"))),
 			_groups(R_do_slot(x, Rf_install("group"))),
-			_pointers(R_do_slot(x, Rf_install("pointers"))) {}
+			_pointers(R_do_slot(x, Rf_install("pointers")))
+		{
+			_gap = coalesce_gap();
+			_nthreads = io_threads();
+		}
 
 		~Atoms() {
-			_io.exit_streams();
+			self_destruct();
+		}
+
+		// max gap (in elements) to read through when coalescing
+		// (negative means never coalesce scattered reads)
+		static index_t coalesce_gap()
+		{
+			SEXP gap = Rf_GetOption1(Rf_install("matter.coalesce.gap"));
+			if ( Rf_isNumeric(gap) && LENGTH(gap) > 0 ) {
+				double g = Rf_asReal(gap);
+				if ( !isNA(g) )
+					return static_cast<index_t>(g);
+			}
+			return -1;
 		}
 
 		void self_destruct() {
 			_io.exit_streams();
+			_batching = false;
+			std::vector<ReadTask>().swap(_tasks);
+			std::unordered_map<int,std::vector<index_t>>().swap(_cumextents);
 		}
 
 		R_xlen_t natoms() {
@@ -181,31 +783,349 @@ class Atoms {
 			return n;
 		}
 
+		// cumulative extents within a group (built lazily per group)
+		index_t * cumextents(int grp)
+		{
+			std::vector<index_t> & cum = _cumextents[is_flat() ? -1 : grp];
+			if ( cum.empty() ) {
+				int start = find_group(grp);
+				int n = find_group_end(grp) - start;
+				cum.resize(n + 1);
+				cum[0] = 0;
+				for ( int k = 0; k < n; k++ )
+					cum[k + 1] = cum[k] + extent(start + k);
+			}
+			return cum.data();
+		}
+
 		AtomInfo find_atom(index_t i, int grp = 0)
 		{
-			index_t j = 0;
-			int atom = find_group(grp);
+			int start = find_group(grp);
+			int n = find_group_end(grp) - start;
 			AtomInfo ap;
-			if ( i == 0 && extent(atom) == 0)
+			if ( i == 0 && extent(start) == 0)
 			{
-				ap = {atom, 0};
+				ap = {start, 0};
 				return ap;
 			}
-			while ( i >= 0 && group(atom) == grp && atom < natoms() )
+			index_t * cum = cumextents(grp);
+			if ( i >= 0 && i < cum[n] )
 			{
-				index_t len = extent(atom);
-				if ( j <= i && i < j + len )
+				// check last atom hit and its successor first
+				int k = _last_atom - start;
+				for ( int t = 0; t < 2 && k < n; t++, k++ )
 				{
-					ap = {atom, i - j};
-					return ap;
+					if ( k >= 0 && cum[k] <= i && i < cum[k + 1] ) {
+						_last_atom = start + k;
+						ap = {start + k, i - cum[k]};
+						return ap;
+					}
 				}
-				j += len;
-				atom++;
+				// binary search for last atom starting at or before i
+				int lo = 0, hi = n;
+				while ( hi - lo > 1 )
+				{
+					int mid = lo + (hi - lo) / 2;
+					if ( cum[mid] <= i )
+						lo = mid;
+					else
+						hi = mid;
+				}
+				_last_atom = start + lo;
+				ap = {start + lo, i - cum[lo]};
+				return ap;
 			}
 			self_destruct();
 			Rf_error("subscript out of bounds");
 		}
 
+		// ask the os to start loading all atoms in the background
+		void prefetch()
+		{
+			int atom = 0;
+			while ( atom < natoms() )
+			{
+				int n = compute_block(atom);
+				index_t start = offset(atom);
+				index_t end = offset(atom + n - 1, extent(atom + n - 1));
+				_io.prefetch(source(atom), start, end - start);
+				atom += n;
+			}
+		}
+
+		// ask the os to start loading elements 'i' of groups 'j'
+		// (1-based, NULL for all) in the background, merging the
+		// byte ranges of nearby elements into as few hints as possible
+		void prefetch(SEXP i, SEXP j)
+		{
+			int psrc = -1;
+			index_t pstart = 0, pend = 0;
+			// add elements [pos, pos + n) of an atom to the pending range
+			auto hint = [&](int atom, index_t pos, index_t n) {
+				int src = source(atom);
+				index_t start = offset(atom, pos);
+				index_t end = offset(atom, pos + n);
+				if ( src == psrc && start >= pstart && start <= pend + READS_MAXGAP ) {
+					pend = max2(pend, end);
+					return;
+				}
+				if ( psrc >= 0 )
+					_io.prefetch(psrc, pstart, pend - pstart);
+				psrc = src;
+				pstart = start;
+				pend = end;
+			};
+			// add elements [k, k + n) of a group
+			auto region = [&](index_t k, index_t n, int grp) {
+				index_t len = group_extent(grp);
+				if ( k < 0 || k >= len )
+					return;
+				n = min2(n, len - k);
+				AtomInfo ap = find_atom(k, grp);
+				int atom = ap.atom;
+				index_t pos = ap.pos;
+				while ( n > 0 && atom < natoms() && group(atom) == grp )
+				{
+					index_t m = min2(extent(atom) - pos, n);
+					if ( m > 0 )
+						hint(atom, pos, m);
+					n -= m;
+					pos = 0;
+					atom++;
+				}
+			};
+			index_t ng = Rf_isNull(j) ? ngroups() : XLENGTH(j);
+			index_t ni = Rf_isNull(i) ? 0 : XLENGTH(i);
+			for ( index_t g = 0; g < ng; g++ )
+			{
+				index_t grp = g;
+				if ( !Rf_isNull(j) ) {
+					grp = IndexElt(j, g);
+					if ( isNA(grp) )
+						continue;
+					grp--;
+				}
+				if ( grp < 0 || grp >= ngroups() )
+					continue;
+				if ( Rf_isNull(i) ) {
+					region(0, group_extent(grp), grp);
+					continue;
+				}
+				index_t k = 0;
+				while ( k < ni )
+				{
+					// take runs of consecutive indices together
+					index_t first = IndexElt(i, k), n = 1;
+					if ( !isNA(first) ) {
+						while ( k + n < ni && IndexElt(i, k + n) == first + n )
+							n++;
+						region(first - 1, n, grp);
+					}
+					k += n;
+				}
+			}
+			if ( psrc >= 0 )
+				_io.prefetch(psrc, pstart, pend - pstart);
+		}
+
+		// number of threads for batched reads
+		static int io_threads()
+		{
+			SEXP n = Rf_GetOption1(Rf_install("matter.io.threads"));
+			if ( Rf_isNumeric(n) && LENGTH(n) > 0 ) {
+				int nt = Rf_asInteger(n);
+				if ( !isNA(nt) && nt > 1 )
+					return nt;
+			}
+			return 1;
+		}
+
+		// start queueing atom reads to be done together
+		// (if 'gather' then queue them even without threads
+		// so nearby reads are merged, e.g., for tiled data,
+		// unless memory-mapped where there's nothing to merge,
+		// or if descriptors aren't pooled, so gathering would
+		// open the file again on every call)
+		// (returns false if reads are not queued)
+		bool begin_reads(bool gather = false)
+		{
+		#ifdef MATTER_HAS_MMAP
+			if ( _batching || _io.cached() )
+				return false;
+			if ( _nthreads < 2 && (!gather || _io.iomode() == IO_MMAP ||
+				!handle_pool().enabled()) )
+			{
+				return false;
+			}
+			_io.flush(); // make pending writes visible
+			_batching = true;
+			_tasks.clear();
+			return true;
+		#else
+			return false;
+		#endif
+		}
+
+		// perform queued reads concurrently and finish them
+		void end_reads()
+		{
+			_batching = false;
+			if ( _tasks.empty() )
+				return;
+			// read each source sequentially (as far as possible)
+			std::sort(_tasks.begin(), _tasks.end(),
+				[](const ReadTask & a, const ReadTask & b) {
+					if ( a.source != b.source )
+						return a.source < b.source;
+					return a.offset < b.offset;
+				});
+			// resolve mapped bytes now that no more remapping can happen
+			// (each source is remapped at most once to cover its reads)
+			for ( size_t i = 0; i < _tasks.size(); )
+			{
+				int src = _tasks[i].source;
+				size_t j = i;
+				index_t end = 0;
+				for ( ; j < _tasks.size() && _tasks[j].source == src; j++ )
+					end = max2(end, _tasks[j].offset + static_cast<index_t>(_tasks[j].nbytes));
+				_io.mapped(src, 0, end);
+				for ( ; i < j; i++ )
+					_tasks[i].mapped = _io.mapped(src, _tasks[i].offset,
+						_tasks[i].nbytes, false);
+			}
+			// merge nearby (or overlapping) small reads into runs
+			std::vector<ReadRun> runs;
+			for ( size_t i = 0; i < _tasks.size(); i++ )
+			{
+				ReadTask & t = _tasks[i];
+				if ( !runs.empty() && t.mapped == NULL )
+				{
+					ReadRun & r = runs.back();
+					index_t end = r.offset + r.nbytes;
+					bool mergeable = t.nbytes < READS_MERGEBYTES &&
+						(r.last - r.first > 1 || r.nbytes < READS_MERGEBYTES) &&
+						t.offset + t.nbytes - r.offset <= READS_MAXMERGE;
+					if ( r.mapped == NULL && r.source == t.source &&
+						t.offset <= end + READS_MAXGAP && mergeable )
+					{
+						index_t tend = t.offset + t.nbytes;
+						r.nbytes = tend > end ? tend - r.offset : r.nbytes;
+						r.last = i + 1;
+						r.direct = false;
+						continue;
+					}
+				}
+				ReadRun r = {t.source, t.offset, t.nbytes, t.mapped,
+					i, i + 1, 0, t.direct};
+				runs.push_back(r);
+			}
+			size_t nraw = 0, total = 0;
+			for ( size_t k = 0; k < runs.size(); k++ )
+			{
+				ReadRun & r = runs[k];
+				if ( !r.direct ) {
+					r.raw = nraw;
+					nraw += r.nbytes;
+				}
+				total += r.nbytes;
+				for ( size_t i = r.first; i < r.last; i++ )
+					_tasks[i].raw = r.raw + (_tasks[i].offset - r.offset);
+			}
+			// open descriptors on the main thread
+			std::vector<int> fds(runs.size(), -1);
+			for ( size_t k = 0; k < runs.size(); k++ )
+			{
+				if ( runs[k].mapped != NULL )
+					continue;
+				fds[k] = _io.descriptor(runs[k].source);
+				if ( fds[k] < 0 ) {
+					const char * filename = CHAR(_io.path(runs[k].source));
+					self_destruct();
+					Rf_error("could not open file '%s'", filename);
+				}
+			}
+			char * raw = NULL;
+			if ( nraw > 0 )
+				raw = (char *) R_Calloc(nraw, char);
+			// split runs into slices of about equal bytes
+			int nthreads = min2(_nthreads, static_cast<int>(runs.size()));
+			if ( total < static_cast<size_t>(THREADS_MINBYTES) * 2 )
+				nthreads = 1;
+			std::vector<size_t> bounds(nthreads + 1, runs.size());
+			bounds[0] = 0;
+			size_t acc = 0;
+			int k = 1;
+			for ( size_t i = 0; i < runs.size() && k < nthreads; i++ )
+			{
+				acc += runs[i].nbytes;
+				if ( acc * nthreads >= total * k )
+					bounds[k++] = i + 1;
+			}
+			// read raw bytes (no R API calls in here)
+			std::vector<char> failed(nthreads, 0);
+			std::vector<ReadTask> & tasks = _tasks;
+			run_threads(nthreads, [&](int id) {
+				for ( size_t i = bounds[id]; i < bounds[id + 1]; i++ )
+				{
+					ReadRun & r = runs[i];
+					char * dest = r.direct ? tasks[r.first].dest : raw + r.raw;
+					if ( r.mapped != NULL )
+						std::memcpy(dest, r.mapped, r.nbytes);
+					else if ( !DataSources::pread_all(fds[i], dest, r.nbytes, r.offset) ) {
+						failed[id] = 1;
+						break;
+					}
+				}
+			});
+			bool success = true;
+			for ( int id = 0; id < nthreads; id++ )
+				if ( failed[id] )
+					success = false;
+			for ( size_t i = 0; i < runs.size(); i++ )
+				if ( runs[i].mapped == NULL )
+					_io.consumed(runs[i].source, runs[i].offset, runs[i].nbytes);
+			// copy and coerce on the main thread
+			if ( success ) {
+				for ( size_t i = 0; i < runs.size(); i++ )
+				{
+					if ( runs[i].direct )
+						continue;
+					for ( size_t j = runs[i].first; j < runs[i].last; j++ )
+					{
+						ReadTask & t = _tasks[j];
+						if ( t.direct )
+							std::memcpy(t.dest, raw + t.raw, t.nbytes);
+						else
+							t.finish(t, raw + t.raw);
+					}
+				}
+			}
+			if ( raw != NULL )
+				Free(raw);
+			_tasks.clear();
+			if ( !success ) {
+				self_destruct();
+				Rf_error("failed to read data elements");
+			}
+		}
+
+		template<typename Tin, typename Tout>
+		void queue_read(Tout * ptr, int atom, index_t off, size_t size, int stride)
+		{
+			ReadTask t;
+			t.source = source(atom);
+			t.offset = off;
+			t.nbytes = sizeof(Tin) * size;
+			t.mapped = NULL; // resolved in end_reads()
+			t.dest = reinterpret_cast<char *>(ptr);
+			t.raw = 0;
+			t.size = size;
+			t.stride = stride;
+			t.direct = std::is_same<Tin,Tout>::value && stride == 1;
+			t.finish = &finish_read<Tin,Tout>;
+			_tasks.push_back(t);
+		}
+
 		int find_group(int grp) {
 			if ( is_flat() )
 				return 0;
@@ -213,6 +1133,17 @@ class Atoms {
 				return _pointers[grp];
 		}
 
+		index_t group_extent(int grp) {
+			return cumextents(grp)[find_group_end(grp) - find_group(grp)];
+		}
+
+		int find_group_end(int grp) {
+			if ( is_flat() || grp + 1 >= _pointers.length() )
+				return natoms();
+			else
+				return _pointers[grp + 1];
+		}
+
 		bool is_flat() {
 			return _flatten;
 		}
@@ -290,8 +1221,38 @@ class Atoms {
 			// allow specifying size > extent for convenience
 			if ( pos + size >= extent(atom) )
 				size = extent(atom) - pos;
-			Tin * tmp = (Tin *) R_Calloc(size, Tin);
 			index_t off = offset(atom, pos);
+			// defer to a batch of concurrent reads
+			if ( _batching && !_io.compressed(source(atom)) ) {
+				queue_read<Tin,Tout>(ptr, atom, off, size, stride);
+				return size;
+			}
+			// no coercion needed if types match and data is contiguous
+			bool direct = std::is_same<Tin,Tout>::value && stride == 1;
+			// coerce directly from mapped pages if possible
+			char * src = _io.mapped(source(atom), off, sizeof(Tin) * size);
+			if ( src != NULL ) {
+				if ( direct ) {
+					std::memcpy(ptr, src, sizeof(Tin) * size);
+					return size;
+				}
+				Tin val;
+				for ( size_t i = 0; i < size; i++ ) {
+					std::memcpy(&val, src + sizeof(Tin) * i, sizeof(Tin));
+					ptr[stride * i] = coerce_cast<Tout>(val);
+				}
+				return size;
+			}
+			// read directly into the output buffer if possible
+			if ( direct ) {
+				bool success = _io.rseek(source(atom), off)->read<Tin>(ptr, size);
+				if ( !success ) {
+					self_destruct();
+					Rf_error("failed to read data elements");
+				}
+				return size;
+			}
+			Tin * tmp = (Tin *) R_Calloc(size, Tin);
 			bool success = _io.rseek(source(atom), off)->read<Tin>(tmp, size);
 			if ( !success ) {
 				Free(tmp);
@@ -315,10 +1276,23 @@ class Atoms {
 			// allow specifying size > extent for convenience
 			if ( pos + size >= extent(atom) )
 				size = extent(atom) - pos; 
+			index_t off = offset(atom, pos);
+			// coerce directly into mapped pages if possible
+			char * dest = NULL;
+			if ( !_io.readonly() )
+				dest = _io.mapped(source(atom), off, sizeof(Tout) * size);
+			if ( dest != NULL ) {
+				_io.invalidate(source(atom), off, sizeof(Tout) * size);
+				Tout val;
+				for ( size_t i = 0; i < size; i++ ) {
+					val = coerce_cast<Tout>(ptr[stride * i]);
+					std::memcpy(dest + sizeof(Tout) * i, &val, sizeof(Tout));
+				}
+				return size;
+			}
 			Tout * tmp = (Tout *) R_Calloc(size, Tout);
 			for ( size_t i = 0; i < size; i++ )
 				tmp[i] = coerce_cast<Tout>(ptr[stride * i]);
-			index_t off = offset(atom, pos);
 			bool success = _io.wseek(source(atom), off)->write<Tout>(tmp, size);
 			if ( !success ) {
 				Free(tmp);
@@ -393,6 +1367,10 @@ class Atoms {
 			AtomInfo ap = find_atom(i, grp);
 			int atom = ap.atom;
 			index_t n, pos = ap.pos, num_read = 0, num_toread = size;
+			// read atoms concurrently if region spans several
+			bool batch = false;
+			if ( extent(atom) - pos < num_toread )
+				batch = begin_reads();
 			while ( num_toread > 0 )
 			{
 				if ( atom >= natoms() || group(atom) != grp ) {
@@ -406,6 +1384,8 @@ class Atoms {
 				atom++;
 				ptr += (stride * n);
 			}
+			if ( batch )
+				end_reads();
 			return num_read;
 		}
 
@@ -431,11 +1411,92 @@ class Atoms {
 			return num_write;
 		}
 
+		// should scattered reads be sorted and coalesced?
+		template<typename Tind>
+		bool use_coalesce(Tind * pindx, size_t size)
+		{
+			if ( _gap < 0 || size < 2 || _batching )
+				return false;
+			size_t nruns = 1;
+			for ( size_t k = 1; k < size; k++ )
+			{
+				if ( isNA(pindx[k]) || isNA(pindx[k - 1]) )
+					nruns++;
+				else if ( !equal<double>(std::fabs(pindx[k] - pindx[k - 1]), 1) )
+					nruns++;
+			}
+			return nruns > 1 && size < nruns * COALESCE_RUNLEN;
+		}
+
+		// read scattered elements in sorted order, merging reads of
+		// indices that are within 'gap' elements of each other,
+		// then scatter the values back in the requested order
+		template<typename Tind, typename Tval>
+		size_t get_elements_coalesced(Tval * ptr, Tind * pindx, size_t size,
+			int grp = 0, int stride = 1, bool ind1 = false)
+		{
+			index_t * ord = (index_t *) R_Calloc(size, index_t);
+			size_t nvalid = 0;
+			for ( size_t k = 0; k < size; k++ )
+			{
+				if ( isNA(pindx[k]) )
+					ptr[stride * k] = NA<Tval>();
+				else
+					ord[nvalid++] = k;
+			}
+			std::sort(ord, ord + nvalid,
+				[pindx](index_t a, index_t b) { return pindx[a] < pindx[b]; });
+			Tval * buffer = NULL;
+			if ( nvalid > 0 )
+			{
+				index_t lo = pindx[ord[0]] - ind1;
+				index_t hi = pindx[ord[nvalid - 1]] - ind1;
+				if ( lo < 0 || hi >= group_extent(grp) ) {
+					Free(ord);
+					self_destruct();
+					Rf_error("subscript out of bounds");
+				}
+				index_t buffersize = std::min<index_t>(hi - lo + 1, COALESCE_MAXREAD);
+				buffer = (Tval *) R_Calloc(buffersize, Tval);
+			}
+			size_t k = 0;
+			while ( k < nvalid )
+			{
+				// extend the read while the next index is close enough
+				index_t first = pindx[ord[k]] - ind1, last = first;
+				size_t m = k + 1;
+				while ( m < nvalid )
+				{
+					index_t next = pindx[ord[m]] - ind1;
+					if ( next - last > _gap + 1 || next - first >= COALESCE_MAXREAD )
+						break;
+					last = next;
+					m++;
+				}
+				get_region<Tval>(buffer, first, last - first + 1, grp);
+				for ( ; k < m; k++ )
+				{
+					index_t i = pindx[ord[k]] - ind1;
+					ptr[stride * ord[k]] = buffer[i - first];
+				}
+			}
+			if ( buffer != NULL )
+				Free(buffer);
+			Free(ord);
+			return size;
+		}
+
 		template<typename Tind, typename Tval>
 		size_t get_elements(Tval * ptr, Tind * pindx, size_t size,
 			int grp = 0, int stride = 1, bool ind1 = false)
 		{
+			if ( use_coalesce<Tind>(pindx, size) )
+				return get_elements_coalesced<Tind,Tval>(ptr, pindx, size,
+					grp, stride, ind1);
 			index_t n, i = 0, num_read = 0, num_toread = size;
+			bool batch = false;
+			if ( size > 1 )
+				batch = begin_reads();
 			while ( num_toread > 0 )
 			{
 				RunInfo<Tind> run = compute_run<Tind>(pindx, 0, num_toread, RUN_SEQ);
@@ -455,6 +1516,8 @@ class Atoms {
 				pindx += n;
 				ptr += (stride * n);
 			}
+			if ( batch )
+				end_reads();
 			return num_read;
 		}
 
@@ -758,6 +1821,12 @@ class Atoms {
 		CompressedVector<double> _extents; // number of elements
 		CompressedVector<int> _groups; // 0-based organization
 		CompressedVector<int> _pointers; // 0-based pointers to groups
+		std::unordered_map<int,std::vector<index_t>> _cumextents; // per group
+		int _last_atom = 0; // cache most recent atom found
+		index_t _gap; // max gap for coalesced reads
+		int _nthreads; // threads for batched reads
+		bool _batching = false; // queue reads?
+		std::vector<ReadTask> _tasks; // queued reads
 		bool _flatten = false;
 
 };
@@ -0,0 +1,271 @@
+#ifndef BLOCK_CACHE
+#define BLOCK_CACHE
+
+#include <list>
+#include <string>
+#include <iterator>
+#include <functional>
+#include <vector>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include "matterDefines.h"
+
+// eviction policies
+// (must match options)
+#define CACHE_LRU	1
+#define CACHE_CLOCK	2
+
+// size of cached blocks in bytes
+#define CACHE_BLOCKSIZE 65536
+
+//// BlockCache class
+//--------------------
+
+// process-wide cache of file blocks keyed by (file, aligned offset)
+class BlockCache {
+
+	public:
+
+		struct BlockKey {
+			int file;
+			index_t offset;
+			bool operator==(const BlockKey & other) const {
+				return file == other.file && offset == other.offset;
+			}
+		};
+
+		struct BlockKeyHash {
+			size_t operator()(const BlockKey & k) const {
+				size_t h = std::hash<index_t>()(k.offset);
+				return h ^ (std::hash<int>()(k.file) + 0x9e3779b9 + (h << 6) + (h >> 2));
+			}
+		};
+
+		struct Block {
+			int file;
+			index_t offset;
+			std::vector<char> data;
+			bool ref;
+		};
+
+		BlockCache() {}
+
+		~BlockCache() {}
+
+		void configure(double capacity, int policy)
+		{
+			_capacity = capacity > 0 ? static_cast<size_t>(capacity) : 0;
+			if ( policy != _policy ) {
+				_policy = policy;
+				_hand = _blocks.end();
+			}
+			trim(_capacity);
+		}
+
+		bool enabled() {
+			return _capacity >= CACHE_BLOCKSIZE;
+		}
+
+		int policy() {
+			return _policy;
+		}
+
+		size_t capacity() {
+			return _capacity;
+		}
+
+		size_t size() {
+			return _size;
+		}
+
+		size_t nblocks() {
+			return _blocks.size();
+		}
+
+		double hits() {
+			return _hits;
+		}
+
+		double misses() {
+			return _misses;
+		}
+
+		// get id for a file and check whether it changed on disk
+		int file_id(const char * path)
+		{
+			std::string name(path);
+			int id;
+			auto it = _files.find(name);
+			if ( it == _files.end() ) {
+				id = static_cast<int>(_files.size());
+				_files[name] = id;
+				_stamps.push_back({-1, 0, 0});
+			}
+			else
+				id = it->second;
+			FileStamp stamp = {-1, 0, 0};
+			struct stat info;
+			if ( stat(path, &info) == 0 )
+				stamp = {static_cast<double>(info.st_size),
+					static_cast<double>(info.st_mtime), mtime_nsec(info)};
+			if ( stamp.size != _stamps[id].size || stamp.mtime != _stamps[id].mtime ||
+				stamp.mtime_ns != _stamps[id].mtime_ns )
+			{
+				invalidate(id);
+				_stamps[id] = stamp;
+			}
+			return id;
+		}
+
+		// get id for a file already in the cache (or -1)
+		int find_file(const char * path)
+		{
+			auto it = _files.find(std::string(path));
+			return it != _files.end() ? it->second : -1;
+		}
+
+		Block * find(int file, index_t offset)
+		{
+			auto it = _index.find(key(file, offset));
+			if ( it == _index.end() ) {
+				_misses++;
+				return NULL;
+			}
+			_hits++;
+			if ( _policy == CACHE_LRU )
+				_blocks.splice(_blocks.begin(), _blocks, it->second);
+			else
+				it->second->ref = true;
+			return &(*(it->second));
+		}
+
+		Block * insert(int file, index_t offset, const char * data, size_t size)
+		{
+			if ( !enabled() )
+				return NULL;
+			trim(_capacity - CACHE_BLOCKSIZE);
+			Block b = {file, offset, std::vector<char>(data, data + size), false};
+			std::list<Block>::iterator it;
+			if ( _policy == CACHE_LRU )
+				it = _blocks.insert(_blocks.begin(), b);
+			else
+				it = _blocks.insert(_hand, b); // inspected last
+			_index[key(file, offset)] = it;
+			_size += CACHE_BLOCKSIZE;
+			return &(*it);
+		}
+
+		// drop blocks overlapping [offset, offset + size)
+		void invalidate(int file, index_t offset, size_t size)
+		{
+			index_t start = offset - (offset % CACHE_BLOCKSIZE);
+			index_t end = offset + static_cast<index_t>(size);
+			for ( index_t b = start; b < end; b += CACHE_BLOCKSIZE )
+			{
+				auto it = _index.find(key(file, b));
+				if ( it != _index.end() )
+					erase(it->second);
+			}
+		}
+
+		// drop all blocks for a file
+		void invalidate(int file)
+		{
+			auto it = _blocks.begin();
+			while ( it != _blocks.end() ) {
+				auto next = std::next(it);
+				if ( it->file == file )
+					erase(it);
+				it = next;
+			}
+		}
+
+		void clear()
+		{
+			_blocks.clear();
+			_index.clear();
+			_hand = _blocks.end();
+			_size = 0;
+			_hits = 0;
+			_misses = 0;
+		}
+
+	protected:
+
+		struct FileStamp {
+			double size;
+			double mtime;
+			double mtime_ns; // sub-second part (0 if unavailable)
+		};
+
+		// sub-second part of the modification time (so that a
+		// same-size rewrite within one second is still noticed)
+		static double mtime_nsec(const struct stat & info)
+		{
+		#if defined(__APPLE__)
+			return static_cast<double>(info.st_mtimespec.tv_nsec);
+		#elif defined(_WIN32)
+			return 0;
+		#else
+			return static_cast<double>(info.st_mtim.tv_nsec);
+		#endif
+		}
+
+		BlockKey key(int file, index_t offset) {
+			BlockKey k = {file, offset};
+			return k;
+		}
+
+		void erase(std::list<Block>::iterator it)
+		{
+			if ( it == _hand )
+				_hand = std::next(_hand);
+			_index.erase(key(it->file, it->offset));
+			_blocks.erase(it);
+			_size -= CACHE_BLOCKSIZE;
+		}
+
+		// evict blocks until size is at most 'target' bytes
+		void trim(size_t target)
+		{
+			while ( _size > target && !_blocks.empty() )
+			{
+				if ( _policy == CACHE_LRU )
+					erase(std::prev(_blocks.end()));
+				else
+				{
+					// advance clock hand, clearing reference bits
+					if ( _hand == _blocks.end() )
+						_hand = _blocks.begin();
+					if ( _hand->ref ) {
+						_hand->ref = false;
+						_hand = std::next(_hand);
+					}
+					else
+						erase(_hand);
+				}
+			}
+		}
+
+		std::list<Block> _blocks;
+		std::list<Block>::iterator _hand = _blocks.end();
+		std::unordered_map<BlockKey,std::list<Block>::iterator,BlockKeyHash> _index;
+		std::unordered_map<std::string,int> _files;
+		std::vector<FileStamp> _stamps;
+		size_t _capacity = 0;
+		size_t _size = 0;
+		int _policy = CACHE_LRU;
+		double _hits = 0;
+		double _misses = 0;
+
+};
+
+// single instance shared by all translation units
+inline BlockCache & block_cache()
+{
+	static BlockCache cache;
+	return cache;
+}
+
+#endif // BLOCK_CACHE
@@ -0,0 +1,298 @@
+#ifndef BLOCK_COMPRESS
+#define BLOCK_COMPRESS
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// compressed file layout:
+//	magic[8] | size | blocksize | width | nblocks
+//	| offsets[nblocks + 1] | blocks ...
+// where each block is a method byte followed by
+// the (optionally) compressed bytes of 'blocksize'
+// bytes of the original file
+
+#define ZFILE_MAGIC		"MATTERZ1"
+#define ZFILE_MAGICLEN	8
+
+// block compression methods
+#define ZBLOCK_RAW		0 // stored as-is
+#define ZBLOCK_SHUFFLE	1 // byte-shuffled then LZ
+
+// LZ parameters
+#define LZ_MINMATCH		4
+#define LZ_MAXOFFSET	65535
+#define LZ_HASHLOG		14
+
+//// Compressed file header
+//---------------------------
+
+struct ZHeader {
+	uint64_t size; // uncompressed bytes
+	uint32_t blocksize; // uncompressed bytes per block
+	uint32_t width; // element width for shuffling
+	uint64_t nblocks;
+};
+
+inline size_t zheader_size(uint64_t nblocks) {
+	return ZFILE_MAGICLEN + sizeof(ZHeader) + (nblocks + 1) * sizeof(uint64_t);
+}
+
+//// Byte shuffling
+//-------------------
+
+// group the k-th bytes of each element together
+// (makes slowly varying numeric data compressible)
+inline void byte_shuffle(const char * src, char * dest, size_t n, size_t width)
+{
+	size_t nelt = width > 1 ? n / width : 0;
+	for ( size_t j = 0; j < width && nelt > 0; j++ )
+		for ( size_t i = 0; i < nelt; i++ )
+			dest[j * nelt + i] = src[i * width + j];
+	std::memcpy(dest + nelt * width, src + nelt * width, n - nelt * width);
+}
+
+inline void byte_unshuffle(const char * src, char * dest, size_t n, size_t width)
+{
+	size_t nelt = width > 1 ? n / width : 0;
+	for ( size_t j = 0; j < width && nelt > 0; j++ )
+		for ( size_t i = 0; i < nelt; i++ )
+			dest[i * width + j] = src[j * nelt + i];
+	std::memcpy(dest + nelt * width, src + nelt * width, n - nelt * width);
+}
+
+//// LZ compression
+//-------------------
+
+// sequences are: token | literal length | literals | offset | match length
+// (token holds 4 bits each of literal length and match length - 4,
+// with a nibble of 15 continued by bytes of 255 until one is smaller)
+
+inline uint32_t lz_read32(const char * p)
+{
+	uint32_t x;
+	std::memcpy(&x, p, sizeof(uint32_t));
+	return x;
+}
+
+inline uint32_t lz_hash(uint32_t x) {
+	return (x * 2654435761U) >> (32 - LZ_HASHLOG);
+}
+
+inline size_t lz_bound(size_t n) {
+	return n + n / 255 + 16;
+}
+
+inline char * lz_put_length(char * op, size_t len)
+{
+	while ( len >= 255 ) {
+		*op++ = static_cast<char>(255);
+		len -= 255;
+	}
+	*op++ = static_cast<char>(len);
+	return op;
+}
+
+inline char * lz_put_sequence(char * op, const char * lit, size_t nlit,
+	size_t offset, size_t matchlen)
+{
+	char * token = op++;
+	size_t mlen = matchlen > 0 ? matchlen - LZ_MINMATCH : 0;
+	*token = static_cast<char>(((nlit < 15 ? nlit : 15) << 4) | (mlen < 15 ? mlen : 15));
+	if ( nlit >= 15 )
+		op = lz_put_length(op, nlit - 15);
+	std::memcpy(op, lit, nlit);
+	op += nlit;
+	if ( matchlen > 0 ) {
+		*op++ = static_cast<char>(offset & 0xFF);
+		*op++ = static_cast<char>((offset >> 8) & 0xFF);
+		if ( mlen >= 15 )
+			op = lz_put_length(op, mlen - 15);
+	}
+	return op;
+}
+
+// compress n bytes from src into dest (of size >= lz_bound(n))
+// and return the compressed size
+inline size_t lz_compress(const char * src, char * dest, size_t n)
+{
+	std::vector<int64_t> table(1 << LZ_HASHLOG, -1);
+	char * op = dest;
+	size_t i = 0, anchor = 0;
+	while ( i + LZ_MINMATCH <= n )
+	{
+		uint32_t seq = lz_read32(src + i);
+		uint32_t h = lz_hash(seq);
+		int64_t cand = table[h];
+		table[h] = i;
+		if ( cand >= 0 && i - cand <= LZ_MAXOFFSET && lz_read32(src + cand) == seq )
+		{
+			size_t len = LZ_MINMATCH;
+			while ( i + len < n && src[cand + len] == src[i + len] )
+				len++;
+			op = lz_put_sequence(op, src + anchor, i - anchor, i - cand, len);
+			i += len;
+			anchor = i;
+		}
+		else
+			i++;
+	}
+	op = lz_put_sequence(op, src + anchor, n - anchor, 0, 0);
+	return op - dest;
+}
+
+// decompress exactly n bytes into dest (returns false if corrupt)
+inline bool lz_decompress(const char * src, size_t srclen, char * dest, size_t n)
+{
+	const char * ip = src;
+	const char * iend = src + srclen;
+	size_t k = 0;
+	while ( ip < iend )
+	{
+		unsigned char token = static_cast<unsigned char>(*ip++);
+		size_t nlit = token >> 4;
+		if ( nlit == 15 ) {
+			unsigned char b;
+			do {
+				if ( ip >= iend )
+					return false;
+				b = static_cast<unsigned char>(*ip++);
+				nlit += b;
+			} while ( b == 255 );
+		}
+		if ( nlit > static_cast<size_t>(iend - ip) || nlit > n - k )
+			return false;
+		std::memcpy(dest + k, ip, nlit);
+		ip += nlit;
+		k += nlit;
+		if ( ip == iend )
+			break; // last sequence has no match
+		if ( iend - ip < 2 )
+			return false;
+		size_t offset = static_cast<unsigned char>(ip[0]) |
+			(static_cast<unsigned char>(ip[1]) << 8);
+		ip += 2;
+		size_t len = (token & 0x0F);
+		if ( len == 15 ) {
+			unsigned char b;
+			do {
+				if ( ip >= iend )
+					return false;
+				b = static_cast<unsigned char>(*ip++);
+				len += b;
+			} while ( b == 255 );
+		}
+		len += LZ_MINMATCH;
+		if ( offset == 0 || offset > k || len > n - k )
+			return false;
+		// copy byte-wise (matches may overlap)
+		for ( size_t i = 0; i < len; i++, k++ )
+			dest[k] = dest[k - offset];
+	}
+	return k == n;
+}
+
+//// Block encoding
+//-------------------
+
+// encode a block into dest (of size >= lz_bound(n) + 1)
+// and return the encoded size
+inline size_t zblock_encode(const char * src, char * dest, size_t n, size_t width)
+{
+	std::vector<char> shuffled(n);
+	byte_shuffle(src, shuffled.data(), n, width);
+	size_t len = lz_compress(shuffled.data(), dest + 1, n);
+	if ( len < n ) {
+		dest[0] = ZBLOCK_SHUFFLE;
+		return len + 1;
+	}
+	dest[0] = ZBLOCK_RAW;
+	std::memcpy(dest + 1, src, n);
+	return n + 1;
+}
+
+// decode a block of n bytes (returns false if corrupt)
+inline bool zblock_decode(const char * src, size_t srclen, char * dest,
+	size_t n, size_t width)
+{
+	if ( srclen < 1 )
+		return false;
+	switch(src[0]) {
+		case ZBLOCK_RAW:
+			if ( srclen - 1 != n )
+				return false;
+			std::memcpy(dest, src + 1, n);
+			return true;
+		case ZBLOCK_SHUFFLE: {
+			std::vector<char> shuffled(n);
+			if ( !lz_decompress(src + 1, srclen - 1, shuffled.data(), n) )
+				return false;
+			byte_unshuffle(shuffled.data(), dest, n, width);
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+//// File encoding
+//-------------------
+
+// compress a file into the block format above
+// (returns 0 on success, 1 if the input can't be read,
+// and 2 if the output can't be written; on failure any
+// partially written output file is removed)
+inline int zfile_compress(const char * inpath, const char * outpath,
+	size_t width, size_t blocksize)
+{
+	std::ifstream in(inpath, std::ios::in | std::ios::binary);
+	if ( !in.is_open() )
+		return 1;
+	in.seekg(0, std::ios::end);
+	uint64_t size = static_cast<uint64_t>(in.tellg());
+	in.seekg(0, std::ios::beg);
+	std::ofstream out(outpath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if ( !out.is_open() )
+		return 2;
+	ZHeader header;
+	header.size = size;
+	header.blocksize = static_cast<uint32_t>(blocksize);
+	header.width = static_cast<uint32_t>(width);
+	header.nblocks = (size + blocksize - 1) / blocksize;
+	std::vector<uint64_t> offsets(header.nblocks + 1);
+	offsets[0] = zheader_size(header.nblocks);
+	// write placeholder header then fill it in after
+	std::vector<char> pad(offsets[0], 0);
+	out.write(pad.data(), pad.size());
+	std::vector<char> buffer(blocksize);
+	std::vector<char> encoded(lz_bound(blocksize) + 1);
+	for ( uint64_t b = 0; b < header.nblocks; b++ )
+	{
+		size_t n = static_cast<size_t>(size - b * blocksize);
+		n = n < blocksize ? n : blocksize;
+		in.read(buffer.data(), n);
+		if ( in.fail() ) {
+			out.close();
+			std::remove(outpath);
+			return 1;
+		}
+		size_t len = zblock_encode(buffer.data(), encoded.data(), n, width);
+		out.write(encoded.data(), len);
+		offsets[b + 1] = offsets[b] + len;
+	}
+	out.seekp(0, std::ios::beg);
+	out.write(ZFILE_MAGIC, ZFILE_MAGICLEN);
+	out.write(reinterpret_cast<char *>(&header), sizeof(ZHeader));
+	out.write(reinterpret_cast<char *>(offsets.data()),
+		sizeof(uint64_t) * offsets.size());
+	out.close();
+	if ( out.fail() ) {
+		std::remove(outpath);
+		return 2;
+	}
+	return 0;
+}
+
+#endif // BLOCK_COMPRESS
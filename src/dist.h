@@ -12,6 +12,37 @@
 //// Distance
 //-------------
 
+// contribution of one (unsigned) difference to an additive metric
+inline double dist_term(double d, int metric, double p = 2)
+{
+	switch(metric) {
+		case DIST_EUC:
+			return d * d;
+		case DIST_ABS:
+			return d;
+		case DIST_MKW:
+			return std::pow(d, p);
+		default:
+			Rf_error("unrecognized distance metric");
+	}
+}
+
+// distance from a sum of additive metric terms
+inline double dist_final(double D, int metric, double p = 2)
+{
+	D = D < 0 ? 0 : D; // guard against rounding error
+	switch(metric) {
+		case DIST_EUC:
+			return std::sqrt(D);
+		case DIST_ABS:
+			return D;
+		case DIST_MKW:
+			return std::pow(D, 1 / p);
+		default:
+			return NA_REAL;
+	}
+}
+
 // calculate distance between k-dim points
 template<typename T>
 double do_dist(T * x, T * y, size_t k, int stepx = 1, int stepy = 1,
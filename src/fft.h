@@ -0,0 +1,94 @@
+#ifndef FOURIER
+#define FOURIER
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "matterDefines.h"
+
+typedef std::complex<double> complex_t;
+
+//// Fast Fourier transform
+//--------------------------
+
+// smallest power of 2 >= n
+inline size_t next_pow2(size_t n)
+{
+	size_t m = 1;
+	while ( m < n )
+		m <<= 1;
+	return m;
+}
+
+// radix-2 FFT plan for a (power of 2) length n, holding
+// the twiddle factors and bit-reversal permutation so they
+// are computed once and reused for every transform
+class FFTPlan {
+
+	public:
+
+		FFTPlan(size_t n = 1) : _n(next_pow2(n)),
+			_twiddle(_n / 2), _perm(_n)
+		{
+			for ( size_t k = 0; k < _n / 2; k++ )
+			{
+				double theta = -2 * M_PI * k / _n;
+				_twiddle[k] = complex_t(std::cos(theta), std::sin(theta));
+			}
+			size_t nbits = 0;
+			while ( (static_cast<size_t>(1) << nbits) < _n )
+				nbits++;
+			for ( size_t i = 0; i < _n; i++ )
+			{
+				size_t r = 0;
+				for ( size_t b = 0; b < nbits; b++ )
+					if ( i & (static_cast<size_t>(1) << b) )
+						r |= static_cast<size_t>(1) << (nbits - b - 1);
+				_perm[i] = r;
+			}
+		}
+
+		size_t length() const {
+			return _n;
+		}
+
+		// in-place transform (the inverse is unnormalized)
+		void transform(complex_t * z, bool inverse = false) const
+		{
+			for ( size_t i = 0; i < _n; i++ )
+			{
+				if ( i < _perm[i] ) {
+					complex_t t = z[i];
+					z[i] = z[_perm[i]];
+					z[_perm[i]] = t;
+				}
+			}
+			for ( size_t len = 2; len <= _n; len <<= 1 )
+			{
+				size_t half = len / 2, step = _n / len;
+				for ( size_t i = 0; i < _n; i += len )
+				{
+					for ( size_t k = 0; k < half; k++ )
+					{
+						complex_t w = _twiddle[k * step];
+						if ( inverse )
+							w = std::conj(w);
+						complex_t u = z[i + k];
+						complex_t v = z[i + k + half] * w;
+						z[i + k] = u + v;
+						z[i + k + half] = u - v;
+					}
+				}
+			}
+		}
+
+	protected:
+
+		size_t _n;
+		std::vector<complex_t> _twiddle;
+		std::vector<size_t> _perm;
+
+};
+
+#endif // FOURIER
@@ -0,0 +1,347 @@
+#ifndef MATRIX_FILTERS
+#define MATRIX_FILTERS
+
+#include <vector>
+
+#include "matterDefines.h"
+#include "matter.h"
+#include "sparse.h"
+#include "signal.h"
+#include "threads.h"
+
+// number of elements read per block from matter/sparse matrices
+#define FILTER_BLOCKSIZE 1048576
+
+// 1D filters (applied to each row or column)
+#define FILT1_MA		1 // moving average
+#define FILT1_CONV		2 // linear (gaussian, savitzky-golay, etc.)
+#define FILT1_BI		3 // bilateral (or adaptive bilateral)
+#define FILT1_DIFF		4 // nonlinear diffusion
+#define FILT1_GUIDE		5 // guided (self-guided)
+#define FILT1_PAG		6 // peak-aware guided
+
+//// Matrix signals
+//--------------------
+
+// process the rows (margin = 1) or columns (margin = 2) of
+// an R matrix, a matter_mat, or a sparse_mat as signals,
+// reading blocks of whole rows/columns into contiguous buffers
+// (so out-of-memory matrices are read only once)
+class MatrixSignals {
+
+	public:
+
+		MatrixSignals(int margin) : _margin(margin)
+		{
+			if ( _margin != 1 && _margin != 2 )
+				Rf_error("margin must be 1 or 2");
+		}
+
+		virtual ~MatrixSignals() {}
+
+		// process all signals, returns false if interrupted
+		bool read_signals(SEXP x)
+		{
+			if ( is_Rclass(x, "sparse_mat") ) {
+				SparseMatrix xm(x);
+				return read_blocks(xm, xm.nrow(), xm.ncol());
+			}
+			else if ( is_Rclass(x, "matter_mat") ) {
+				MatterMatrix xm(x);
+				return read_blocks(xm, xm.nrow(), xm.ncol());
+			}
+			else {
+				if ( TYPEOF(x) != LGLSXP && TYPEOF(x) != INTSXP && TYPEOF(x) != REALSXP )
+					Rf_error("unsupported data type");
+				return read_blocks(x, Rf_nrows(x), Rf_ncols(x));
+			}
+		}
+
+	protected:
+
+		// process signals from + 1 to from + nk (1-based subscripts
+		// 'indx') of length len, stored contiguously in x
+		virtual void process_block(double * x, SEXP indx,
+			size_t from, size_t nk, size_t len) = 0;
+
+		template<class M>
+		bool read_blocks(M & xm, size_t nr, size_t nc)
+		{
+			_nr = nr;
+			_nc = nc;
+			size_t len = _margin == 1 ? nc : nr;
+			size_t ext = _margin == 1 ? nr : nc;
+			size_t bs = len > 0 ? FILTER_BLOCKSIZE / len : 0;
+			bs = bs > 0 ? bs : 1;
+			bs = bs < ext ? bs : ext;
+			std::vector<double> block, xbuf(len * bs);
+			if ( _margin == 1 )
+				block.resize(len * bs);
+			SEXP indx;
+			for ( size_t k = 0; k < ext; k += bs )
+			{
+				size_t nk = (k + bs) < ext ? bs : (ext - k);
+				PROTECT(indx = index_seq(k, nk));
+				if ( _margin == 1 ) {
+					get_block(xm, indx, R_NilValue, block.data());
+					transpose(block.data(), xbuf.data(), nk, len);
+				}
+				else
+					get_block(xm, R_NilValue, indx, xbuf.data());
+				process_block(xbuf.data(), indx, k, nk, len);
+				UNPROTECT(1);
+				if ( pendingInterrupt() )
+					return false;
+			}
+			return true;
+		}
+
+		// transpose a column-major nr x nc matrix
+		void transpose(double * x, double * y, size_t nr, size_t nc)
+		{
+			for ( size_t j = 0; j < nc; j++ )
+				for ( size_t i = 0; i < nr; i++ )
+					y[i * nc + j] = x[j * nr + i];
+		}
+
+		void get_block(MatterMatrix & xm, SEXP i, SEXP j, double * buffer)
+		{
+			xm.get_submatrix<double>(i, j, buffer);
+		}
+
+		void get_block(SparseMatrix & xm, SEXP i, SEXP j, double * buffer)
+		{
+			if ( xm.indextype() == INTSXP )
+				xm.get_submatrix<int,double>(i, j, buffer);
+			else
+				xm.get_submatrix<double,double>(i, j, buffer);
+		}
+
+		void get_block(SEXP x, SEXP i, SEXP j, double * buffer)
+		{
+			size_t nr = Rf_nrows(x), nc = Rf_ncols(x);
+			size_t r0 = 0, c0 = 0, nrk = nr, nck = nc;
+			if ( !Rf_isNull(i) ) {
+				r0 = IndexElt(i, 0) - 1;
+				nrk = XLENGTH(i);
+			}
+			if ( !Rf_isNull(j) ) {
+				c0 = IndexElt(j, 0) - 1;
+				nck = XLENGTH(j);
+			}
+			for ( size_t c = 0; c < nck; c++ )
+			{
+				for ( size_t r = 0; r < nrk; r++ )
+				{
+					R_xlen_t k = (c0 + c) * nr + (r0 + r);
+					switch(TYPEOF(x)) {
+						case LGLSXP:
+						case INTSXP: {
+							int v = INTEGER(x)[k];
+							buffer[c * nrk + r] = isNA(v) ? NA_REAL : v;
+							break;
+						}
+						case REALSXP:
+							buffer[c * nrk + r] = REAL(x)[k];
+							break;
+					}
+				}
+			}
+		}
+
+		// 1-based subscripts from + 1 to from + n
+		SEXP index_seq(size_t from, size_t n)
+		{
+			SEXP indx = Rf_allocVector(REALSXP, n);
+			for ( size_t k = 0; k < n; k++ )
+				REAL(indx)[k] = from + k + 1;
+			return indx;
+		}
+
+		int _margin;
+		size_t _nr, _nc;
+
+};
+
+//// Matrix filtering
+//--------------------
+
+// filter the rows (margin = 1) or columns (margin = 2) of
+// a matrix, filtering the signals in each block concurrently;
+// 'params' holds the filter-specific (scalar) parameters:
+//	bi: sddist, sdrange, spar, nlevels (0 = exact, NA = auto)
+//	diff: niter, kappa, rate, method
+//	guide/pag: sdreg, ftol
+// where an NA sdrange or sdreg is estimated from each signal
+class MatrixFilter : public MatrixSignals {
+
+	public:
+
+		MatrixFilter(int method, int margin, int width,
+			SEXP weights, SEXP params, int nthreads)
+			: MatrixSignals(margin), _method(method), _width(width),
+			_nthreads(nthreads > 1 ? nthreads : 1)
+		{
+			if ( _method < FILT1_MA || _method > FILT1_PAG )
+				Rf_error("unsupported filter");
+			if ( _method == FILT1_CONV ) {
+				_width = LENGTH(weights);
+				_weights = REAL(weights);
+			}
+			else
+				_weights = NULL;
+			for ( int k = 0; k < LENGTH(params); k++ )
+				_params.push_back(REAL(params)[k]);
+			_params.resize(4, NA_REAL);
+			if ( _method == FILT1_DIFF ) {
+				int cmethod = static_cast<int>(_params[3]);
+				if ( cmethod < DIFF_EQ1 || cmethod > DIFF_PAW )
+					Rf_error("unrecognized conduction method");
+			}
+		}
+
+		// filter x into 'out' (an R double matrix or a matter_mat)
+		void apply(SEXP x, SEXP out)
+		{
+			_out = out;
+			if ( !read_signals(x) )
+				Rf_error("user interrupt");
+		}
+
+	protected:
+
+		// filter one signal (no R API calls for threaded filters)
+		void filter(double * x, size_t n, double * y, double scale)
+		{
+			switch(_method) {
+				case FILT1_MA:
+					mean_filter(x, n, _width, y);
+					break;
+				case FILT1_CONV:
+					linear_filter(x, n, _weights, _width, y);
+					break;
+				case FILT1_BI:
+					if ( approx() )
+						bilateral_filter_fast(x, n, _params[0],
+							isNA(_params[1]) ? scale : _params[1], nlevels(), y);
+					else
+						bilateral_filter(x, n, _width, _params[0],
+							isNA(_params[1]) ? scale : _params[1], _params[2], y);
+					break;
+				case FILT1_DIFF:
+					diffusion_filter(x, n, static_cast<int>(_params[0]),
+						_params[1], _params[2], static_cast<int>(_params[3]), y);
+					break;
+				case FILT1_GUIDE:
+					guided_filter(x, x, n, _width,
+						isNA(_params[0]) ? scale : _params[0], NA_REAL, y);
+					break;
+				case FILT1_PAG: {
+					std::vector<double> g(n);
+					diffusion_filter(x, n, 3, 50, 0.25, DIFF_PAW, g.data());
+					guided_filter(x, g.data(), n, _width,
+						isNA(_params[0]) ? scale : _params[0], _params[1], y);
+					break;
+				}
+			}
+		}
+
+		// whether to use the approximate bilateral filter
+		bool approx()
+		{
+			return _method == FILT1_BI && _params[3] != 0 && isNA(_params[2]);
+		}
+
+		int nlevels()
+		{
+			return isNA(_params[3]) ? NA_INTEGER : static_cast<int>(_params[3]);
+		}
+
+		// whether a per-signal scale (MAD) must be estimated
+		bool needs_scale()
+		{
+			switch(_method) {
+				case FILT1_BI:
+					return isNA(_params[1]) && isNA(_params[2]);
+				case FILT1_GUIDE:
+				case FILT1_PAG:
+					return isNA(_params[0]);
+				default:
+					return false;
+			}
+		}
+
+		// the moving average, linear, and (non-adaptive) bilateral
+		// filters don't allocate so they can be run off the main thread
+		bool threadable()
+		{
+			switch(_method) {
+				case FILT1_MA:
+				case FILT1_CONV:
+					return true;
+				case FILT1_BI:
+					return isNA(_params[2]);
+				default:
+					return false;
+			}
+		}
+
+		// filter nk signals of length len stored contiguously
+		void filter_block(double * x, double * y, size_t nk, size_t len)
+		{
+			std::vector<double> scale(nk, NA_REAL);
+			if ( needs_scale() )
+				for ( size_t k = 0; k < nk; k++ )
+					scale[k] = quick_mad(x + k * len, len);
+			int nthreads = threadable() ? _nthreads : 1;
+			if ( nk < static_cast<size_t>(nthreads) )
+				nthreads = nk;
+			run_threads(nthreads, [&](int id) {
+				for ( size_t k = id; k < nk; k += nthreads )
+					filter(x + k * len, len, y + k * len, scale[k]);
+			});
+		}
+
+		void process_block(double * x, SEXP indx,
+			size_t from, size_t nk, size_t len)
+		{
+			std::vector<double> y(len * nk);
+			filter_block(x, y.data(), nk, len);
+			if ( _margin == 1 ) {
+				std::vector<double> block(len * nk);
+				transpose(y.data(), block.data(), len, nk);
+				put_block(_out, indx, R_NilValue, block.data(), _nr, _nc);
+			}
+			else
+				put_block(_out, R_NilValue, indx, y.data(), _nr, _nc);
+		}
+
+		// write a (column-major) block into an R matrix or matter_mat
+		void put_block(SEXP out, SEXP i, SEXP j, double * buffer,
+			size_t nr, size_t nc)
+		{
+			if ( is_Rclass(out, "matter_mat") ) {
+				MatterMatrix ym(out);
+				ym.set_submatrix<double>(i, j, buffer);
+				return;
+			}
+			size_t r0 = Rf_isNull(i) ? 0 : IndexElt(i, 0) - 1;
+			size_t c0 = Rf_isNull(j) ? 0 : IndexElt(j, 0) - 1;
+			size_t nrk = Rf_isNull(i) ? nr : XLENGTH(i);
+			size_t nck = Rf_isNull(j) ? nc : XLENGTH(j);
+			double * y = REAL(out);
+			for ( size_t c = 0; c < nck; c++ )
+				for ( size_t r = 0; r < nrk; r++ )
+					y[(c0 + c) * nr + (r0 + r)] = buffer[c * nrk + r];
+		}
+
+		int _method;
+		int _width;
+		int _nthreads;
+		double * _weights;
+		std::vector<double> _params;
+		SEXP _out;
+
+};
+
+#endif // MATRIX_FILTERS
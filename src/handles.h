@@ -0,0 +1,315 @@
+#ifndef HANDLE_POOL
+#define HANDLE_POOL
+
+#include <list>
+#include <string>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+#endif
+
+// default maximum number of idle file handles
+#define HANDLES_MAXOPEN 64
+
+//// HandlePool class
+//--------------------
+
+// process-wide pool of open file streams keyed by (path, mode)
+// and read-only descriptors keyed by path (for positioned reads
+// and i/o hints) so that files aren't reopened on every call from R
+// (handles are dropped in forked children, which would
+// otherwise share file offsets with their parent)
+class HandlePool {
+
+	public:
+
+		HandlePool() : _pid(getpid()) {}
+
+		~HandlePool() {
+			clear();
+		}
+
+		void configure(int maxopen)
+		{
+			_maxopen = maxopen > 0 ? maxopen : 0;
+			trim(_maxopen);
+		}
+
+		bool enabled() {
+			return _maxopen > 0;
+		}
+
+		size_t size() {
+			check_fork();
+			return _handles.size();
+		}
+
+		size_t idle() {
+			check_fork();
+			return _handles.size() - _inuse;
+		}
+
+		double hits() {
+			return _hits;
+		}
+
+		double misses() {
+			return _misses;
+		}
+
+		// get an open stream (or NULL if the file can't be opened)
+		std::fstream * acquire(const char * path, std::ios::openmode mode)
+		{
+			check_fork();
+			std::string name(path);
+			FileId id = file_id(path);
+			auto it = _handles.begin();
+			while ( it != _handles.end() )
+			{
+				auto next = std::next(it);
+				if ( !it->inuse && it->stream != NULL && it->path == name )
+				{
+					if ( !same_file(it->id, id) )
+						erase(it); // removed or replaced on disk
+					else if ( it->mode == mode ) {
+						it->inuse = true;
+						it->stream->clear();
+						_handles.splice(_handles.begin(), _handles, it);
+						_inuse++;
+						_hits++;
+						return it->stream;
+					}
+				}
+				it = next;
+			}
+			_misses++;
+			std::fstream * stream = new std::fstream();
+			stream->open(path, mode);
+			if ( !stream->is_open() ) {
+				delete stream;
+				return NULL;
+			}
+			Handle h = {name, mode, id, stream, -1, true};
+			_handles.push_front(h);
+			_inuse++;
+			return stream;
+		}
+
+		// get an open read-only descriptor (or -1 if unavailable)
+		int acquire_fd(const char * path)
+		{
+		#ifndef _WIN32
+			check_fork();
+			std::string name(path);
+			FileId id = file_id(path);
+			auto it = _handles.begin();
+			while ( it != _handles.end() )
+			{
+				auto next = std::next(it);
+				if ( !it->inuse && it->stream == NULL && it->path == name )
+				{
+					if ( !same_file(it->id, id) )
+						erase(it); // removed or replaced on disk
+					else {
+						it->inuse = true;
+						_handles.splice(_handles.begin(), _handles, it);
+						_inuse++;
+						_hits++;
+						return it->fd;
+					}
+				}
+				it = next;
+			}
+			_misses++;
+			int fd = open(path, O_RDONLY);
+			if ( fd < 0 )
+				return -1;
+			Handle h = {name, std::ios::in, id, NULL, fd, true};
+			_handles.push_front(h);
+			_inuse++;
+			return fd;
+		#else
+			return -1;
+		#endif
+		}
+
+		// return a descriptor to the pool (closing it if disabled)
+		void release_fd(int fd)
+		{
+		#ifndef _WIN32
+			check_fork();
+			for ( auto it = _handles.begin(); it != _handles.end(); ++it )
+			{
+				if ( it->stream == NULL && it->fd == fd ) {
+					it->inuse = false;
+					_inuse--;
+					trim(_maxopen);
+					return;
+				}
+			}
+			close(fd);
+		#endif
+		}
+
+		// return a stream to the pool (closing it if disabled)
+		void release(std::fstream * stream)
+		{
+			check_fork();
+			for ( auto it = _handles.begin(); it != _handles.end(); ++it )
+			{
+				if ( it->stream != NULL && it->stream == stream ) {
+					it->stream->flush();
+					it->inuse = false;
+					_inuse--;
+					trim(_maxopen);
+					return;
+				}
+			}
+			stream->close();
+			delete stream;
+		}
+
+		// close idle handles for a file (e.g., before it's removed)
+		void invalidate(const char * path)
+		{
+			check_fork();
+			std::string name(path);
+			auto it = _handles.begin();
+			while ( it != _handles.end() ) {
+				auto next = std::next(it);
+				if ( !it->inuse && it->path == name )
+					erase(it);
+				it = next;
+			}
+		}
+
+		// close all idle handles
+		void clear()
+		{
+			check_fork();
+			auto it = _handles.begin();
+			while ( it != _handles.end() ) {
+				auto next = std::next(it);
+				if ( !it->inuse )
+					erase(it);
+				it = next;
+			}
+			_hits = 0;
+			_misses = 0;
+		}
+
+	protected:
+
+		// identifies a file on disk by device and inode
+		// (Windows has no inode numbers, so size and
+		// modification time are used there instead)
+		struct FileId {
+			bool exists;
+			double key1;
+			double key2;
+		};
+
+		// an open stream, or a descriptor if 'stream' is NULL
+		struct Handle {
+			std::string path;
+			std::ios::openmode mode;
+			FileId id;
+			std::fstream * stream;
+			int fd;
+			bool inuse;
+		};
+
+		FileId file_id(const char * path)
+		{
+			FileId id = {false, 0, 0};
+			struct stat info;
+			if ( stat(path, &info) == 0 ) {
+			#ifdef _WIN32
+				id = {true, static_cast<double>(info.st_size),
+					static_cast<double>(info.st_mtime)};
+			#else
+				id = {true, static_cast<double>(info.st_dev),
+					static_cast<double>(info.st_ino)};
+			#endif
+			}
+			return id;
+		}
+
+		bool same_file(const FileId & a, const FileId & b) {
+			return a.exists && b.exists && a.key1 == b.key1 && a.key2 == b.key2;
+		}
+
+		void close_handle(Handle & h)
+		{
+			if ( h.stream != NULL ) {
+				h.stream->close();
+				delete h.stream;
+			}
+		#ifndef _WIN32
+			else if ( h.fd >= 0 )
+				close(h.fd);
+		#endif
+		}
+
+		void erase(std::list<Handle>::iterator it)
+		{
+			if ( it->inuse )
+				_inuse--;
+			close_handle(*it);
+			_handles.erase(it);
+		}
+
+		// drop handles inherited from the parent process
+		// (handles still in use are closed when released)
+		void check_fork()
+		{
+			pid_t pid = getpid();
+			if ( pid == _pid )
+				return;
+			auto it = _handles.begin();
+			while ( it != _handles.end() ) {
+				auto next = std::next(it);
+				if ( !it->inuse )
+					close_handle(*it);
+				_handles.erase(it);
+				it = next;
+			}
+			_inuse = 0;
+			_pid = pid;
+		}
+
+		// close least recently used idle handles until
+		// at most 'maxidle' idle handles are left open
+		void trim(size_t maxidle)
+		{
+			auto it = _handles.end();
+			while ( _handles.size() - _inuse > maxidle && it != _handles.begin() )
+			{
+				auto prev = std::prev(it);
+				if ( !prev->inuse )
+					erase(prev);
+				else
+					it = prev;
+			}
+		}
+
+		std::list<Handle> _handles;
+		pid_t _pid;
+		size_t _maxopen = HANDLES_MAXOPEN;
+		size_t _inuse = 0;
+		double _hits = 0;
+		double _misses = 0;
+
+};
+
+// single instance shared by all translation units
+inline HandlePool & handle_pool()
+{
+	static HandlePool pool;
+	return pool;
+}
+
+#endif // HANDLE_POOL
@@ -38,6 +38,13 @@ static const R_CallMethodDef callMethods[] = {
 	CALLDEF(subsetAtoms, 2),
 	CALLDEF(regroupAtoms, 2),
 	CALLDEF(ungroupAtoms, 1),
+	CALLDEF(prefetchAtoms, 3),
+	// block cache
+	CALLDEF(getBlockCache, 1),
+	// file handle pool
+	CALLDEF(closeHandles, 1),
+	// block compressed files
+	CALLDEF(compressFile, 3),
 	// matter data structures
 	CALLDEF(getMatterArray, 2),
 	CALLDEF(setMatterArray, 3),
@@ -46,19 +53,28 @@ static const R_CallMethodDef callMethods[] = {
 	CALLDEF(getMatterListElt, 3),
 	CALLDEF(setMatterListElt, 4),
 	CALLDEF(getMatterListSubset, 3),
+	CALLDEF(getMatterListPacked, 2),
 	CALLDEF(setMatterListSubset, 4),
 	CALLDEF(getMatterStrings, 3),
 	CALLDEF(setMatterStrings, 4),
 	// sparse data structures
 	CALLDEF(getSparseArray, 2),
 	CALLDEF(getSparseMatrix, 3),
+	CALLDEF(rmatmulSparse, 2),
+	CALLDEF(lmatmulSparse, 2),
+	CALLDEF(rowDistSparse, 5),
+	CALLDEF(colDistSparse, 5),
+	// summary statistics
+	CALLDEF(rowStats, 5),
+	CALLDEF(colStats, 5),
 	// 1d signal processing
 	CALLDEF(meanFilter, 2),
 	CALLDEF(linearFilter, 2),
-	CALLDEF(bilateralFilter, 5),
+	CALLDEF(bilateralFilter, 6),
 	CALLDEF(diffusionFilter, 5),
 	CALLDEF(guidedFilter, 5),
-	CALLDEF(warpDTW, 6),
+	CALLDEF(filterMatrix, 8),
+	CALLDEF(warpDTW, 8),
 	CALLDEF(warpCOW, 8),
 	CALLDEF(iCor, 2),
 	CALLDEF(binVector, 5),
@@ -70,13 +86,16 @@ static const R_CallMethodDef callMethods[] = {
 	CALLDEF(localMaxima, 2),
 	CALLDEF(peakBoundaries, 2),
 	CALLDEF(peakBases, 2),
+	CALLDEF(continuousWT, 2),
+	CALLDEF(findPeaksCWT, 4),
+	CALLDEF(findPeaksCWTMatrix, 6),
 	CALLDEF(peakWidths, 6),
 	CALLDEF(peakAreas, 5),
 	CALLDEF(Approx1, 7),
 	// 2d signal processing
 	CALLDEF(meanFilter2, 2),
 	CALLDEF(linearFilter2, 2),
-	CALLDEF(bilateralFilter2, 5),
+	CALLDEF(bilateralFilter2, 6),
 	CALLDEF(diffusionFilter2, 5),
 	CALLDEF(guidedFilter2, 4),
 	CALLDEF(histEq, 2),
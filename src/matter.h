@@ -66,16 +66,72 @@ class MatterArray : public Matter {
 			return ops()->nops() != 0;
 		}
 
+		// deferred ops are computed as double before coercion
+		// (e.g., comparisons of double data give logical results)
+		template<typename T>
+		bool staged_ops() {
+			return has_ops() && !std::is_same<T,double>::value;
+		}
+
+		template<typename T>
+		void copy_staged(const double * x, T * buffer, size_t n, int stride)
+		{
+			for ( size_t k = 0; k < n; k++ )
+				buffer[stride * k] = isNA(x[k]) ? NA<T>() : coerce_cast<T>(x[k]);
+		}
+
+		// subscripts [from, from + n) of indx (or of 1:n if NULL)
+		// so staged reads can be done one block at a time
+		static SEXP index_block(SEXP indx, index_t from, size_t n)
+		{
+			SEXP block;
+			if ( Rf_isNull(indx) ) {
+				PROTECT(block = Rf_allocVector(INTSXP, n));
+				for ( size_t k = 0; k < n; k++ )
+					INTEGER(block)[k] = static_cast<int>(from + k + 1);
+			}
+			else if ( TYPEOF(indx) == INTSXP ) {
+				PROTECT(block = Rf_allocVector(INTSXP, n));
+				std::memcpy(INTEGER(block), INTEGER(indx) + from, n * sizeof(int));
+			}
+			else {
+				PROTECT(block = Rf_allocVector(REALSXP, n));
+				std::memcpy(REAL(block), REAL(indx) + from, n * sizeof(double));
+			}
+			UNPROTECT(1);
+			return block;
+		}
+
 		template<typename T>
 		size_t get_region(index_t i, size_t size, T * buffer, int stride = 1)
 		{
 			R_xlen_t len = length();
 			size = len - i > size ? size : len - i;
+			if ( staged_ops<T>() ) {
+				std::vector<double> tmp(min2(size, static_cast<size_t>(OPS_STAGESIZE)));
+				size_t n = 0;
+				while ( n < size )
+				{
+					size_t nk = get_region<double>(i + n,
+						min2(size - n, tmp.size()), tmp.data());
+					if ( nk == 0 )
+						break;
+					copy_staged<T>(tmp.data(), buffer + stride * n, nk, stride);
+					n += nk;
+				}
+				return n;
+			}
 			if ( is_transposed() && stride != 0 )
 			{
-				index_t tindx [size];
-				transpose_range(tindx, i, size);
-				data()->flatten()->get_elements<index_t,T>(buffer, tindx, size, 0, stride);
+				// read each row-major segment with one call
+				Atoms * x = data()->flatten();
+				bool batch = x->begin_reads(size > 1);
+				transpose_segments(i, size,
+					[&](index_t pos, index_t k, size_t n, index_t step) {
+						x->get_region<T>(buffer + stride * k, pos, n, 0, stride * step);
+					});
+				if ( batch )
+					x->end_reads();
 			}
 			else
 				data()->flatten()->get_region<T>(buffer, i, size, 0, stride);
@@ -96,9 +152,11 @@ class MatterArray : public Matter {
 			size = len - i > size ? size : len - i;
 			if ( is_transposed() && stride != 0 )
 			{
-				index_t tindx [size];
-				transpose_range(tindx, i, size);
-				data()->flatten()->set_elements<index_t,T>(buffer, tindx, size, 0, stride);
+				Atoms * x = data()->flatten();
+				transpose_segments(i, size,
+					[&](index_t pos, index_t k, size_t n, index_t step) {
+						x->set_region<T>(buffer + stride * k, pos, n, 0, stride * step);
+					});
 			}
 			else
 				data()->flatten()->set_region<T>(buffer, i, size, 0, stride);
@@ -110,11 +168,24 @@ class MatterArray : public Matter {
 		size_t get_elements(SEXP indx, T * buffer, int stride = 1)
 		{
 			R_xlen_t size = XLENGTH(indx);
+			if ( staged_ops<T>() ) {
+				std::vector<double> tmp(min2(size, static_cast<R_xlen_t>(OPS_STAGESIZE)));
+				for ( R_xlen_t n = 0; n < size; n += tmp.size() )
+				{
+					size_t nk = min2(static_cast<size_t>(size - n), tmp.size());
+					SEXP block;
+					PROTECT(block = index_block(indx, n, nk));
+					get_elements<double>(block, tmp.data());
+					copy_staged<T>(tmp.data(), buffer + stride * n, nk, stride);
+					UNPROTECT(1);
+				}
+				return size;
+			}
 			if ( is_transposed() )
 			{
-				index_t tindx [size];
-				transpose_index(tindx, indx, true);
-				data()->flatten()->get_elements<index_t,T>(buffer, tindx, size, 0, stride, true);
+				std::vector<index_t> tindx(size);
+				transpose_index(tindx.data(), indx, true);
+				data()->flatten()->get_elements<index_t,T>(buffer, tindx.data(), size, 0, stride, true);
 			}
 			else
 				data()->flatten()->get_elements<T>(buffer, indx, 0, stride);
@@ -134,9 +205,9 @@ class MatterArray : public Matter {
 			R_xlen_t size = XLENGTH(indx);
 			if ( is_transposed() )
 			{
-				index_t tindx [size];
-				transpose_index(tindx, indx, true);
-				data()->flatten()->set_elements<index_t,T>(buffer, tindx, size, 0, stride, true);
+				std::vector<index_t> tindx(size);
+				transpose_index(tindx.data(), indx, true);
+				data()->flatten()->set_elements<index_t,T>(buffer, tindx.data(), size, 0, stride, true);
 			}
 			else
 				data()->flatten()->set_elements<T>(buffer, indx, 0, stride);
@@ -286,8 +357,28 @@ class MatterMatrix : public MatterArray {
 			size_t n = 0;
 			int nr = Rf_isNull(i) ? nrow() : LENGTH(i);
 			int nc = Rf_isNull(j) ? ncol() : LENGTH(j);
+			if ( staged_ops<T>() ) {
+				// stage whole columns (at least one at a time)
+				int ncb = max2(OPS_STAGESIZE / max2(nr, 1), 1);
+				ncb = min2(ncb, nc);
+				std::vector<double> tmp(static_cast<size_t>(nr) * ncb);
+				for ( int c = 0; c < nc; c += ncb )
+				{
+					int nk = min2(nc - c, ncb);
+					SEXP block;
+					PROTECT(block = index_block(j, c, nk));
+					n += get_submatrix<double>(i, block, tmp.data());
+					copy_staged<T>(tmp.data(), buffer + static_cast<index_t>(stride) * nr * c,
+						static_cast<size_t>(nr) * nk, stride);
+					UNPROTECT(1);
+				}
+				return n;
+			}
 			int s1 = is_transposed() ? (nr * stride) : stride;
 			int s2 = is_transposed() ? stride : (nr * stride);
+			// gather reads across many rows/cols (merging nearby ones)
+			int nseg = is_transposed() ? nr : nc;
+			bool batch = data()->begin_reads(nseg >= READS_MINGATHER);
 			if ( is_transposed() )
 			{
 				for ( index_t k = 0; k < nr; k++ )
@@ -322,6 +413,8 @@ class MatterMatrix : public MatterArray {
 						n += data()->get_elements<T>(buffer + k * s2, i, col, s1);
 				}
 			}
+			if ( batch )
+				data()->end_reads();
 			if ( has_ops() )
 				ops()->apply<T>(buffer, i, j, stride);
 			return n;
@@ -466,6 +559,189 @@ class MatterList : public Matter {
 			return rank();
 		}
 
+		// make a string from n bytes (stopping at any nul)
+		SEXP make_char(const char * s, size_t n)
+		{
+			if ( n == 0 )
+				return Rf_mkCharLen("", 0);
+			const char * end = static_cast<const char *>(std::memchr(s, '\0', n));
+			size_t len = end != NULL ? end - s : n;
+			if ( len < n )
+				Rf_warning("truncating string with embedded nuls");
+			return Rf_mkCharLen(s, len);
+		}
+
+		index_t index_elt(SEXP i, index_t k)
+		{
+			index_t indk = Rf_isNull(i) ? k : IndexElt(i, k) - 1;
+			if ( indk < 0 || indk >= length() ) {
+				self_destruct();
+				Rf_error("subscript out of bounds");
+			}
+			return indk;
+		}
+
+		// get whole elements in bulk (the atom reads are
+		// queued together so they are done in offset order
+		// and nearby reads are merged)
+		SEXP get_bulk(SEXP i)
+		{
+			SEXP x;
+			R_xlen_t len = Rf_isNull(i) ? length() : XLENGTH(i);
+			std::vector<index_t> indx(len);
+			std::vector<size_t> spos(len, 0);
+			size_t nchar = 0;
+			for ( index_t k = 0; k < len; k++ )
+			{
+				indx[k] = index_elt(i, k);
+				if ( type(indx[k]) == R_CHARACTER ) {
+					spos[k] = nchar;
+					nchar += dim(indx[k]);
+				}
+			}
+			std::vector<char> chars(nchar);
+			PROTECT(x = Rf_allocVector(VECSXP, len));
+			bool batch = data()->begin_reads(len > 1);
+			for ( index_t k = 0; k < len; k++ )
+			{
+				index_t ik = indx[k];
+				R_xlen_t n = dim(ik);
+				SEXP xk = R_NilValue;
+				switch(type(ik)) {
+					case R_RAW:
+						SET_VECTOR_ELT(x, k, xk = Rf_allocVector(RAWSXP, n));
+						if ( n > 0 )
+							data()->get_region<Rbyte>(RAW(xk), 0, n, ik);
+						break;
+					case R_LOGICAL:
+						SET_VECTOR_ELT(x, k, xk = Rf_allocVector(LGLSXP, n));
+						if ( n > 0 )
+							data()->get_region<int>(LOGICAL(xk), 0, n, ik);
+						break;
+					case R_INTEGER:
+						SET_VECTOR_ELT(x, k, xk = Rf_allocVector(INTSXP, n));
+						if ( n > 0 )
+							data()->get_region<int>(INTEGER(xk), 0, n, ik);
+						break;
+					case R_DOUBLE:
+						SET_VECTOR_ELT(x, k, xk = Rf_allocVector(REALSXP, n));
+						if ( n > 0 )
+							data()->get_region<double>(REAL(xk), 0, n, ik);
+						break;
+					case R_CHARACTER:
+						if ( n > 0 )
+							data()->get_region<char>(chars.data() + spos[k], 0, n, ik);
+						break;
+					default:
+						self_destruct();
+						Rf_error("unsupported data type");
+				}
+			}
+			if ( batch )
+				data()->end_reads();
+			for ( index_t k = 0; k < len; k++ )
+			{
+				if ( type(indx[k]) == R_CHARACTER )
+					SET_VECTOR_ELT(x, k, Rf_ScalarString(
+						make_char(chars.data() + spos[k], dim(indx[k]))));
+			}
+			UNPROTECT(1);
+			return x;
+		}
+
+		// get whole elements packed into a single vector (of the
+		// highest type) with 0-based pointers to where each starts
+		SEXP get_packed(SEXP i)
+		{
+			SEXP x, data, pointers;
+			R_xlen_t len = Rf_isNull(i) ? length() : XLENGTH(i);
+			std::vector<index_t> indx(len);
+			int maxtype = R_RAW;
+			bool strings = false;
+			for ( index_t k = 0; k < len; k++ )
+			{
+				indx[k] = index_elt(i, k);
+				int tk = type(indx[k]);
+				if ( tk == R_CHARACTER )
+					strings = true;
+				else
+					maxtype = tk > maxtype ? tk : maxtype;
+			}
+			if ( strings && maxtype != R_RAW ) {
+				self_destruct();
+				Rf_error("can't pack strings with other data types");
+			}
+			if ( strings ) {
+				maxtype = R_CHARACTER;
+				PROTECT(x = get_bulk(i));
+			}
+			PROTECT(pointers = Rf_allocVector(REALSXP, len + 1));
+			double * ptr = REAL(pointers);
+			ptr[0] = 0;
+			for ( index_t k = 0; k < len; k++ )
+				ptr[k + 1] = ptr[k] + (strings ? 1 : dim(indx[k]));
+			R_xlen_t n = static_cast<R_xlen_t>(ptr[len]);
+			switch(maxtype) {
+				case R_RAW:
+					PROTECT(data = Rf_allocVector(RAWSXP, n));
+					break;
+				case R_LOGICAL:
+					PROTECT(data = Rf_allocVector(LGLSXP, n));
+					break;
+				case R_INTEGER:
+					PROTECT(data = Rf_allocVector(INTSXP, n));
+					break;
+				case R_DOUBLE:
+					PROTECT(data = Rf_allocVector(REALSXP, n));
+					break;
+				case R_CHARACTER:
+					PROTECT(data = Rf_allocVector(STRSXP, n));
+					for ( index_t k = 0; k < len; k++ )
+						SET_STRING_ELT(data, k, STRING_ELT(VECTOR_ELT(x, k), 0));
+					break;
+				default:
+					self_destruct();
+					Rf_error("unsupported data type");
+			}
+			if ( !strings )
+			{
+				bool batch = this->data()->begin_reads(len > 1);
+				for ( index_t k = 0; k < len; k++ )
+				{
+					index_t ik = indx[k];
+					index_t pk = static_cast<index_t>(ptr[k]);
+					if ( dim(ik) == 0 )
+						continue;
+					switch(maxtype) {
+						case R_RAW:
+							this->data()->get_region<Rbyte>(RAW(data) + pk, 0, dim(ik), ik);
+							break;
+						case R_LOGICAL:
+							this->data()->get_region<int>(LOGICAL(data) + pk, 0, dim(ik), ik);
+							break;
+						case R_INTEGER:
+							this->data()->get_region<int>(INTEGER(data) + pk, 0, dim(ik), ik);
+							break;
+						case R_DOUBLE:
+							this->data()->get_region<double>(REAL(data) + pk, 0, dim(ik), ik);
+							break;
+					}
+				}
+				if ( batch )
+					this->data()->end_reads();
+			}
+			SEXP names;
+			PROTECT(x = Rf_allocVector(VECSXP, 2));
+			PROTECT(names = Rf_allocVector(STRSXP, 2));
+			SET_VECTOR_ELT(x, 0, data);
+			SET_VECTOR_ELT(x, 1, pointers);
+			SET_STRING_ELT(names, 0, Rf_mkChar("data"));
+			SET_STRING_ELT(names, 1, Rf_mkChar("pointers"));
+			Rf_setAttrib(x, R_NamesSymbol, names);
+			UNPROTECT(strings ? 5 : 4);
+			return x;
+		}
+
 		SEXP get(index_t i)
 		{
 			SEXP x;
@@ -489,13 +765,9 @@ class MatterList : public Matter {
 					data()->get_region<double>(REAL(x), 0, dim(i), i);
 					break;
 				case R_CHARACTER: {
-					char s [dim(i)];
-					data()->get_region<char>(s, 0, dim(i), i);
-					R_xlen_t len = strlen(s);
-					if ( len < dim(i) )
-						Rf_warning("truncating string with embedded nuls");
-					len = len < dim(i) ? len : dim(i);
-					PROTECT(x = Rf_ScalarString(Rf_mkCharLen(s, len)));
+					std::vector<char> s(dim(i));
+					data()->get_region<char>(s.data(), 0, dim(i), i);
+					PROTECT(x = Rf_ScalarString(make_char(s.data(), dim(i))));
 					break;
 				}
 				default:
@@ -569,13 +841,9 @@ class MatterList : public Matter {
 					data()->get_elements<double>(REAL(x), j, i);
 					break;
 				case R_CHARACTER: {
-					char s [LENGTH(j)];
-					data()->get_elements<char>(s, j, i);
-					R_xlen_t len = strlen(s);
-					if ( len < LENGTH(j) )
-						Rf_warning("truncating string with embedded nuls");
-					len = len < LENGTH(j) ? len : LENGTH(j);
-					PROTECT(x = Rf_ScalarString(Rf_mkCharLen(s, len)));
+					std::vector<char> s(LENGTH(j));
+					data()->get_elements<char>(s.data(), j, i);
+					PROTECT(x = Rf_ScalarString(make_char(s.data(), LENGTH(j))));
 					break;
 				}
 				default:
@@ -628,6 +896,8 @@ class MatterList : public Matter {
 
 		SEXP get_elements(SEXP i, SEXP j)
 		{
+			if ( Rf_isNull(j) )
+				return get_bulk(i);
 			SEXP x;
 			R_xlen_t len;
 			if ( Rf_isNull(i) )
@@ -730,6 +1000,15 @@ class MatterStringList : public MatterList {
 				len = length();
 			else
 				len = XLENGTH(i);
+			if ( Rf_isNull(j) ) {
+				SEXP y;
+				PROTECT(y = get_bulk(i));
+				PROTECT(x = Rf_allocVector(STRSXP, len));
+				for ( index_t k = 0; k < len; k++ )
+					SET_STRING_ELT(x, k, STRING_ELT(VECTOR_ELT(y, k), 0));
+				UNPROTECT(2);
+				return x;
+			}
 			PROTECT(x = Rf_allocVector(STRSXP, len));
 			for ( index_t k = 0; k < len; k++ )
 			{
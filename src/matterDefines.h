@@ -4,6 +4,10 @@
 
 #define R_NO_REMAP
 
+#include <vector>
+#include <algorithm>
+#include <complex>
+
 #include <R.h>
 #include <Rinternals.h>
 
@@ -43,6 +47,21 @@ inline bool pendingInterrupt()
 	return !(R_ToplevelExec(checkInterrupt, NULL));
 }
 
+//// Options
+//--------------
+
+// number of threads for native computations
+inline int compute_threads()
+{
+	SEXP n = Rf_GetOption1(Rf_install("matter.compute.threads"));
+	if ( Rf_isNumeric(n) && LENGTH(n) > 0 ) {
+		int nt = Rf_asInteger(n);
+		if ( nt != NA_INTEGER && nt > 1 )
+			return nt;
+	}
+	return 1;
+}
+
 //// Constants
 //--------------
 
@@ -73,6 +92,12 @@ inline bool pendingInterrupt()
 #define C_FLOAT32	9
 #define C_FLOAT64	10
 
+// I/O modes
+#define IO_STREAM	1
+#define IO_MMAP		2
+#define IO_DIRECT	3
+#define IO_COMPRESSED	4
+
 // Arith
 #define OP_ADD		1	// +
 #define OP_SUB		2	// -
@@ -101,6 +126,20 @@ inline bool pendingInterrupt()
 #define MATH_LOG2	19
 #define MATH_LOG1P	20
 #define MATH_EXP	21
+#define MATH_SQRT	22
+#define MATH_ABS	23
+#define MATH_FLOOR	24
+#define MATH_CEIL	25
+#define MATH_TRUNC	26
+#define MATH_ROUND	27
+#define MATH_SIGN	28
+#define MATH_EXPM1	29
+#define MATH_SIN	30
+#define MATH_COS	31
+#define MATH_TAN	32
+#define MATH_ASIN	33
+#define MATH_ACOS	34
+#define MATH_ATAN	35
 
 // Summary
 #define STAT_MAX		1
@@ -332,13 +371,66 @@ class ArrayInterface {
 			return len;
 		}
 
+		// visit the col-major range [i, i + size) of a row-major
+		// array as segments that are contiguous in row-major order,
+		// calling f(pos, k, n, step) for each, where row-major
+		// positions pos, ..., pos + n - 1 are elements k, k + step,
+		// ..., k + (n - 1) * step of the range
+		template<class F>
+		void transpose_segments(index_t i, size_t size, F f)
+		{
+			int r = rank();
+			index_t L = r > 0 ? dim(r - 1) : 1; // extent of last dim
+			index_t P = 1; // extent of leading dims
+			for ( int k = 0; k < r - 1; k++ )
+				P *= dim(k);
+			if ( size == 0 || L == 0 || P == 0 )
+				return;
+			// row-major strides of the leading dims
+			int nlead = r > 1 ? r - 1 : 1;
+			std::vector<index_t> s(nlead, 1), a(nlead, 0);
+			for ( int k = r - 3; k >= 0; k-- )
+				s[k] = s[k + 1] * dim(k + 1);
+			// start at the leading index of the first element
+			index_t p = i % P, t = 0, rem = p;
+			for ( int k = 0; k < r - 1; k++ ) {
+				a[k] = rem % dim(k);
+				rem /= dim(k);
+				t += a[k] * s[k];
+			}
+			index_t n = static_cast<index_t>(size);
+			index_t nseg = n < P ? n : P;
+			for ( index_t m = 0; m < nseg; m++ )
+			{
+				index_t lo = p >= i ? 0 : (i - p + P - 1) / P;
+				index_t hi = (i + n - 1 - p) / P;
+				hi = hi < L ? hi : L - 1;
+				f(t * L + lo, p + lo * P - i, hi - lo + 1, P);
+				// step to the next leading index (wrapping around)
+				if ( ++p == P ) {
+					p = 0;
+					t = 0;
+					std::fill(a.begin(), a.end(), 0);
+					continue;
+				}
+				for ( int k = 0; k < r - 1; k++ ) {
+					a[k]++;
+					t += s[k];
+					if ( a[k] < dim(k) )
+						break;
+					t -= a[k] * s[k];
+					a[k] = 0;
+				}
+			}
+		}
+
 		// convert col-major to row-major index
 		template<typename T>
 		size_t transpose_range(T * tindx, index_t i, size_t size, bool ind1 = false)
 		{
 			size_t nind = 0;
-			int s1 [rank()], s2 [rank()];
-			int arr_ind [rank()];
+			index_t s1 [rank()], s2 [rank()];
+			index_t arr_ind [rank()];
 			s1[0] = 1, s2[rank() - 1] = 1;
 			for ( int k = 1; k < rank(); k++ )
 				s1[k] = s1[k - 1] * dim(k - 1);
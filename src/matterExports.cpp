@@ -578,6 +578,72 @@ SEXP ungroupAtoms(SEXP x)
 	return xa.ungroup_index();
 }
 
+SEXP prefetchAtoms(SEXP x, SEXP i, SEXP j)
+{
+	Atoms xa(x);
+	if ( Rf_isNull(i) && Rf_isNull(j) )
+		xa.prefetch();
+	else
+		xa.prefetch(i, j);
+	return R_NilValue;
+}
+
+// Block cache
+//-------------
+
+SEXP getBlockCache(SEXP clear)
+{
+	SEXP ans, nms;
+	BlockCache & cache = block_cache();
+	PROTECT(ans = Rf_allocVector(REALSXP, 5));
+	PROTECT(nms = Rf_allocVector(STRSXP, 5));
+	REAL(ans)[0] = cache.hits();
+	REAL(ans)[1] = cache.misses();
+	REAL(ans)[2] = cache.nblocks();
+	REAL(ans)[3] = cache.size();
+	REAL(ans)[4] = cache.capacity();
+	SET_STRING_ELT(nms, 0, Rf_mkChar("hits"));
+	SET_STRING_ELT(nms, 1, Rf_mkChar("misses"));
+	SET_STRING_ELT(nms, 2, Rf_mkChar("blocks"));
+	SET_STRING_ELT(nms, 3, Rf_mkChar("size"));
+	SET_STRING_ELT(nms, 4, Rf_mkChar("capacity"));
+	Rf_setAttrib(ans, R_NamesSymbol, nms);
+	if ( Rf_asLogical(clear) )
+		cache.clear();
+	UNPROTECT(2);
+	return ans;
+}
+
+// File handle pool
+//------------------
+
+SEXP closeHandles(SEXP paths)
+{
+	HandlePool & pool = handle_pool();
+	if ( Rf_isNull(paths) )
+		pool.clear();
+	else
+		for ( int i = 0; i < LENGTH(paths); i++ )
+			pool.invalidate(CHAR(STRING_ELT(paths, i)));
+	return R_NilValue;
+}
+
+// Block compressed files
+//------------------------
+
+SEXP compressFile(SEXP path, SEXP outpath, SEXP width)
+{
+	const char * inpath = CHAR(STRING_ELT(path, 0));
+	const char * zpath = CHAR(STRING_ELT(outpath, 0));
+	int status = zfile_compress(inpath, zpath,
+		Rf_asInteger(width), CACHE_BLOCKSIZE);
+	if ( status == 1 )
+		Rf_error("failed to read file '%s'", inpath);
+	if ( status == 2 )
+		Rf_error("failed to write file '%s'", zpath);
+	return outpath;
+}
+
 // Matter data structures
 //-----------------------
 
@@ -626,6 +692,12 @@ SEXP getMatterListSubset(SEXP x, SEXP i, SEXP j)
 	return xm.get_elements(i, j);
 }
 
+SEXP getMatterListPacked(SEXP x, SEXP i)
+{
+	MatterList xm(x);
+	return xm.get_packed(i);
+}
+
 SEXP setMatterListSubset(SEXP x, SEXP i, SEXP j, SEXP value)
 {
 	MatterList xm(x);
@@ -661,6 +733,49 @@ SEXP getSparseMatrix(SEXP x, SEXP i, SEXP j)
 	return xm.get_submatrix(i, j);
 }
 
+SEXP rmatmulSparse(SEXP x, SEXP y)
+{
+	SparseMatrix xm(x);
+	return xm.rmatmul(y);
+}
+
+SEXP lmatmulSparse(SEXP x, SEXP y)
+{
+	SparseMatrix xm(x);
+	return xm.lmatmul(y);
+}
+
+SEXP rowDistSparse(SEXP x, SEXP y, SEXP metric, SEXP p, SEXP weights)
+{
+	SparseMatrix xm(x);
+	return xm.dist(y, 1, Rf_asInteger(metric), Rf_asReal(p), weights);
+}
+
+SEXP colDistSparse(SEXP x, SEXP y, SEXP metric, SEXP p, SEXP weights)
+{
+	SparseMatrix xm(x);
+	return xm.dist(y, 2, Rf_asInteger(metric), Rf_asReal(p), weights);
+}
+
+// Summary statistics
+//--------------------
+
+SEXP rowStats(SEXP x, SEXP stat, SEXP group,
+	SEXP ngroups, SEXP na_rm)
+{
+	MatrixStats s(Rf_asInteger(stat), 1, group,
+		Rf_asInteger(ngroups), Rf_asLogical(na_rm));
+	return s.summarize(x);
+}
+
+SEXP colStats(SEXP x, SEXP stat, SEXP group,
+	SEXP ngroups, SEXP na_rm)
+{
+	MatrixStats s(Rf_asInteger(stat), 2, group,
+		Rf_asInteger(ngroups), Rf_asLogical(na_rm));
+	return s.summarize(x);
+}
+
 // 1D Signal processing
 //----------------------
 
@@ -705,20 +820,29 @@ SEXP linearFilter(SEXP x, SEXP weights)
 }
 
 SEXP bilateralFilter(SEXP x, SEXP width,
-	SEXP sddist, SEXP sdrange, SEXP spar)
+	SEXP sddist, SEXP sdrange, SEXP spar, SEXP nlevels)
 {
 	SEXP result;
 	PROTECT(result = Rf_allocVector(REALSXP, LENGTH(x)));
+	bool approx = Rf_asInteger(nlevels) != 0 && isNA(Rf_asReal(spar));
 	switch(TYPEOF(x)) {
 		case INTSXP:
-			bilateral_filter(INTEGER(x), LENGTH(x), Rf_asInteger(width),
-				Rf_asReal(sddist), Rf_asReal(sdrange),
-				Rf_asReal(spar), REAL(result));
+			if ( approx )
+				bilateral_filter_fast(INTEGER(x), LENGTH(x), Rf_asReal(sddist),
+					Rf_asReal(sdrange), Rf_asInteger(nlevels), REAL(result));
+			else
+				bilateral_filter(INTEGER(x), LENGTH(x), Rf_asInteger(width),
+					Rf_asReal(sddist), Rf_asReal(sdrange),
+					Rf_asReal(spar), REAL(result));
 			break;
 		case REALSXP:
-			bilateral_filter(REAL(x), LENGTH(x), Rf_asInteger(width),
-				Rf_asReal(sddist), Rf_asReal(sdrange),
-				Rf_asReal(spar), REAL(result));
+			if ( approx )
+				bilateral_filter_fast(REAL(x), LENGTH(x), Rf_asReal(sddist),
+					Rf_asReal(sdrange), Rf_asInteger(nlevels), REAL(result));
+			else
+				bilateral_filter(REAL(x), LENGTH(x), Rf_asInteger(width),
+					Rf_asReal(sddist), Rf_asReal(sdrange),
+					Rf_asReal(spar), REAL(result));
 			break;
 		default:
 			Rf_error("unsupported data type");
@@ -773,6 +897,15 @@ SEXP guidedFilter(SEXP x, SEXP g, SEXP width,
 	return result;
 }
 
+SEXP filterMatrix(SEXP x, SEXP out, SEXP margin, SEXP method,
+	SEXP width, SEXP weights, SEXP params, SEXP nthreads)
+{
+	MatrixFilter filt(Rf_asInteger(method), Rf_asInteger(margin),
+		Rf_asInteger(width), weights, params, Rf_asInteger(nthreads));
+	filt.apply(x, out);
+	return out;
+}
+
 SEXP iCor(SEXP x, SEXP y)
 {
 	switch(TYPEOF(x)) {
@@ -790,7 +923,7 @@ SEXP iCor(SEXP x, SEXP y)
 }
 
 SEXP warpDTW(SEXP x, SEXP y, SEXP tx, SEXP ty,
-	SEXP tol, SEXP tol_ref)
+	SEXP tol, SEXP tol_ref, SEXP window, SEXP radius)
 {
 	SEXP result;
 	size_t n = LENGTH(x) + LENGTH(y) - 1;
@@ -800,11 +933,13 @@ SEXP warpDTW(SEXP x, SEXP y, SEXP tx, SEXP ty,
 				switch(TYPEOF(tx)) {
 					case INTSXP:
 						warp_dtwc(INTEGER(x), INTEGER(y), INTEGER(tx), INTEGER(ty), LENGTH(x), LENGTH(y),
-							INTEGER(result), INTEGER(result) + n, Rf_asReal(tol), Rf_asInteger(tol_ref));
+							INTEGER(result), INTEGER(result) + n, Rf_asReal(tol), Rf_asInteger(tol_ref),
+							Rf_asInteger(window), Rf_asInteger(radius));
 						break;
 					case REALSXP:
 						warp_dtwc(INTEGER(x), INTEGER(y), REAL(tx), REAL(ty), LENGTH(x), LENGTH(y),
-							INTEGER(result), INTEGER(result) + n, Rf_asReal(tol), Rf_asInteger(tol_ref));
+							INTEGER(result), INTEGER(result) + n, Rf_asReal(tol), Rf_asInteger(tol_ref),
+							Rf_asInteger(window), Rf_asInteger(radius));
 						break;
 				}
 			}
@@ -813,11 +948,13 @@ SEXP warpDTW(SEXP x, SEXP y, SEXP tx, SEXP ty,
 				switch(TYPEOF(tx)) {
 					case INTSXP:
 						warp_dtwc(REAL(x), REAL(y), INTEGER(tx), INTEGER(ty), LENGTH(x), LENGTH(y),
-							INTEGER(result), INTEGER(result) + n, Rf_asReal(tol), Rf_asInteger(tol_ref));
+							INTEGER(result), INTEGER(result) + n, Rf_asReal(tol), Rf_asInteger(tol_ref),
+							Rf_asInteger(window), Rf_asInteger(radius));
 						break;
 					case REALSXP:
 						warp_dtwc(REAL(x), REAL(y), REAL(tx), REAL(ty), LENGTH(x), LENGTH(y),
-							INTEGER(result), INTEGER(result) + n, Rf_asReal(tol), Rf_asInteger(tol_ref));
+							INTEGER(result), INTEGER(result) + n, Rf_asReal(tol), Rf_asInteger(tol_ref),
+							Rf_asInteger(window), Rf_asInteger(radius));
 						break;
 				}
 			}
@@ -1082,6 +1219,38 @@ SEXP peakBases(SEXP x, SEXP peaks)
 	return ans;
 }
 
+SEXP continuousWT(SEXP x, SEXP wavelets)
+{
+	if ( TYPEOF(x) != REALSXP )
+		Rf_error("unsupported data type");
+	CWT cwt(XLENGTH(x), wavelets);
+	std::vector<complex_t> work(2 * cwt.length());
+	SEXP ans;
+	PROTECT(ans = Rf_allocMatrix(REALSXP, XLENGTH(x), cwt.nscales()));
+	cwt.transform(REAL(x), REAL(ans), work.data());
+	UNPROTECT(1);
+	return ans;
+}
+
+SEXP findPeaksCWT(SEXP x, SEXP wavelets, SEXP maxdists, SEXP params)
+{
+	if ( TYPEOF(x) != REALSXP )
+		Rf_error("unsupported data type");
+	CWTPeakFinder finder(XLENGTH(x), wavelets, maxdists, params);
+	CWTPeakFinder::Workspace ws(finder);
+	CWTPeaks peaks;
+	finder.find(REAL(x), peaks, ws);
+	return finder.peaks_sexp(peaks);
+}
+
+SEXP findPeaksCWTMatrix(SEXP x, SEXP margin, SEXP wavelets,
+	SEXP maxdists, SEXP params, SEXP nthreads)
+{
+	MatrixPeaksCWT finder(Rf_asInteger(margin), wavelets,
+		maxdists, params, Rf_asInteger(nthreads));
+	return finder.apply(x);
+}
+
 SEXP peakWidths(SEXP x, SEXP peaks, SEXP domain,
 	SEXP left_limits, SEXP right_limits, SEXP heights)
 {
@@ -1199,6 +1368,7 @@ SEXP Approx1(SEXP xi, SEXP x, SEXP y,
 SEXP meanFilter2(SEXP x, SEXP width)
 {
 	SEXP result;
+	int nthreads = compute_threads();
 	PROTECT(result = Rf_allocArray(REALSXP, Rf_getAttrib(x, R_DimSymbol)));
 	size_t n = Rf_nrows(x) * Rf_ncols(x);
 	int nchannels = XLENGTH(x) / n;
@@ -1208,11 +1378,11 @@ SEXP meanFilter2(SEXP x, SEXP width)
 		switch(TYPEOF(x)) {
 			case INTSXP:
 				mean_filter2(INTEGER(x) + j, Rf_nrows(x), Rf_ncols(x),
-					Rf_asInteger(width), REAL(result) + j);
+					Rf_asInteger(width), REAL(result) + j, nthreads);
 				break;
 			case REALSXP:
 				mean_filter2(REAL(x) + j, Rf_nrows(x), Rf_ncols(x),
-					Rf_asInteger(width), REAL(result) + j);
+					Rf_asInteger(width), REAL(result) + j, nthreads);
 				break;
 			default:
 				Rf_error("unsupported data type");
@@ -1225,6 +1395,7 @@ SEXP meanFilter2(SEXP x, SEXP width)
 SEXP linearFilter2(SEXP x, SEXP weights)
 {
 	SEXP result;
+	int nthreads = compute_threads();
 	if ( Rf_nrows(weights) != Rf_ncols(weights) )
 		Rf_error("weights must be a square matrix");
 	PROTECT(result = Rf_allocArray(REALSXP, Rf_getAttrib(x, R_DimSymbol)));
@@ -1236,11 +1407,11 @@ SEXP linearFilter2(SEXP x, SEXP weights)
 		switch(TYPEOF(x)) {
 			case INTSXP:
 				linear_filter2(INTEGER(x) + j, Rf_nrows(x), Rf_ncols(x),
-					REAL(weights), Rf_nrows(weights), REAL(result) + j);
+					REAL(weights), Rf_nrows(weights), REAL(result) + j, nthreads);
 				break;
 			case REALSXP:
 				linear_filter2(REAL(x) + j, Rf_nrows(x), Rf_ncols(x),
-					REAL(weights), Rf_nrows(weights), REAL(result) + j);
+					REAL(weights), Rf_nrows(weights), REAL(result) + j, nthreads);
 				break;
 			default:
 				Rf_error("unsupported data type");
@@ -1251,25 +1422,37 @@ SEXP linearFilter2(SEXP x, SEXP weights)
 }
 
 SEXP bilateralFilter2(SEXP x, SEXP width,
-	SEXP sddist, SEXP sdrange, SEXP spar)
+	SEXP sddist, SEXP sdrange, SEXP spar, SEXP nlevels)
 {
 	SEXP result;
+	int nthreads = compute_threads();
 	PROTECT(result = Rf_allocArray(REALSXP, Rf_getAttrib(x, R_DimSymbol)));
 	size_t n = Rf_nrows(x) * Rf_ncols(x);
 	int nchannels = XLENGTH(x) / n;
+	bool approx = Rf_asInteger(nlevels) != 0 && isNA(Rf_asReal(spar));
 	for ( int i = 0; i < nchannels; i++ )
 	{
 		size_t j = n * i;
 		switch(TYPEOF(x)) {
 			case INTSXP:
-				bilateral_filter2(INTEGER(x) + j, Rf_nrows(x), Rf_ncols(x),
-					Rf_asInteger(width), Rf_asReal(sddist), Rf_asReal(sdrange),
-					Rf_asReal(spar), REAL(result) + j);
+				if ( approx )
+					bilateral_filter2_fast(INTEGER(x) + j, Rf_nrows(x), Rf_ncols(x),
+						Rf_asReal(sddist), Rf_asReal(sdrange),
+						Rf_asInteger(nlevels), REAL(result) + j, nthreads);
+				else
+					bilateral_filter2(INTEGER(x) + j, Rf_nrows(x), Rf_ncols(x),
+						Rf_asInteger(width), Rf_asReal(sddist), Rf_asReal(sdrange),
+						Rf_asReal(spar), REAL(result) + j, nthreads);
 				break;
 			case REALSXP:
-				bilateral_filter2(REAL(x) + j, Rf_nrows(x), Rf_ncols(x),
-					Rf_asInteger(width), Rf_asReal(sddist), Rf_asReal(sdrange),
-					Rf_asReal(spar), REAL(result) + j);
+				if ( approx )
+					bilateral_filter2_fast(REAL(x) + j, Rf_nrows(x), Rf_ncols(x),
+						Rf_asReal(sddist), Rf_asReal(sdrange),
+						Rf_asInteger(nlevels), REAL(result) + j, nthreads);
+				else
+					bilateral_filter2(REAL(x) + j, Rf_nrows(x), Rf_ncols(x),
+						Rf_asInteger(width), Rf_asReal(sddist), Rf_asReal(sdrange),
+						Rf_asReal(spar), REAL(result) + j, nthreads);
 				break;
 			default:
 				Rf_error("unsupported data type");
@@ -1283,6 +1466,7 @@ SEXP diffusionFilter2(SEXP x, SEXP niter,
 	SEXP kappa, SEXP rate, SEXP method)
 {
 	SEXP result;
+	int nthreads = compute_threads();
 	PROTECT(result = Rf_allocArray(REALSXP, Rf_getAttrib(x, R_DimSymbol)));
 	size_t n = Rf_nrows(x) * Rf_ncols(x);
 	int nchannels = XLENGTH(x) / n;
@@ -1293,12 +1477,12 @@ SEXP diffusionFilter2(SEXP x, SEXP niter,
 			case INTSXP:
 				diffusion_filter2(INTEGER(x) + j, Rf_nrows(x), Rf_ncols(x),
 					Rf_asInteger(niter), Rf_asReal(kappa), Rf_asReal(rate),
-					Rf_asInteger(method), REAL(result) + j);
+					Rf_asInteger(method), REAL(result) + j, nthreads);
 				break;
 			case REALSXP:
 				diffusion_filter2(REAL(x) + j, Rf_nrows(x), Rf_ncols(x),
 					Rf_asInteger(niter), Rf_asReal(kappa), Rf_asReal(rate),
-					Rf_asInteger(method), REAL(result) + j);
+					Rf_asInteger(method), REAL(result) + j, nthreads);
 				break;
 			default:
 				Rf_error("unsupported data type");
@@ -1312,6 +1496,7 @@ SEXP guidedFilter2(SEXP x, SEXP g, SEXP width,
 	SEXP sdreg)
 {
 	SEXP result;
+	int nthreads = compute_threads();
 	if ( Rf_nrows(x) != Rf_nrows(g) || Rf_ncols(x) != Rf_ncols(g) )
 		Rf_error("signal and guide must have the same dimensions");
 	PROTECT(result = Rf_allocArray(REALSXP, Rf_getAttrib(x, R_DimSymbol)));
@@ -1323,11 +1508,11 @@ SEXP guidedFilter2(SEXP x, SEXP g, SEXP width,
 		switch(TYPEOF(x)) {
 			case INTSXP:
 				guided_filter2(INTEGER(x) + j, INTEGER(g) + j, Rf_nrows(x), Rf_ncols(x),
-					Rf_asInteger(width), Rf_asReal(sdreg), REAL(result) + j);
+					Rf_asInteger(width), Rf_asReal(sdreg), REAL(result) + j, nthreads);
 				break;
 			case REALSXP:
 				guided_filter2(REAL(x) + j, REAL(g) + j, Rf_nrows(x), Rf_ncols(x),
-					Rf_asInteger(width), Rf_asReal(sdreg), REAL(result) + j);
+					Rf_asInteger(width), Rf_asReal(sdreg), REAL(result) + j, nthreads);
 				break;
 			default:
 				Rf_error("unsupported data type");
@@ -6,11 +6,14 @@
 #include "atoms.h"
 #include "matter.h"
 #include "sparse.h"
+#include "summary.h"
 
 #include "dist.h"
 #include "search.h"
 #include "signal.h"
 #include "signal2.h"
+#include "filters.h"
+#include "wavelet.h"
 
 extern "C" {
 
@@ -62,6 +65,22 @@ SEXP writeAtoms(SEXP x, SEXP indx, SEXP value, SEXP grp);
 SEXP subsetAtoms(SEXP x, SEXP indx);
 SEXP regroupAtoms(SEXP x, SEXP n);
 SEXP ungroupAtoms(SEXP x);
+SEXP prefetchAtoms(SEXP x, SEXP i, SEXP j);
+
+// Block cache
+//-------------
+
+SEXP getBlockCache(SEXP clear);
+
+// File handle pool
+//------------------
+
+SEXP closeHandles(SEXP paths);
+
+// Block compressed files
+//------------------------
+
+SEXP compressFile(SEXP path, SEXP outpath, SEXP width);
 
 // Matter data structures
 //-----------------------
@@ -73,6 +92,7 @@ SEXP setMatterMatrix(SEXP x, SEXP i, SEXP j, SEXP value);
 SEXP getMatterListElt(SEXP x, SEXP i, SEXP j);
 SEXP setMatterListElt(SEXP x, SEXP i, SEXP j, SEXP value);
 SEXP getMatterListSubset(SEXP x, SEXP i, SEXP j);
+SEXP getMatterListPacked(SEXP x, SEXP i);
 SEXP setMatterListSubset(SEXP x, SEXP i, SEXP j, SEXP value);
 SEXP getMatterStrings(SEXP x, SEXP i, SEXP j);
 SEXP setMatterStrings(SEXP x, SEXP i, SEXP j, SEXP value);
@@ -82,6 +102,20 @@ SEXP setMatterStrings(SEXP x, SEXP i, SEXP j, SEXP value);
 
 SEXP getSparseArray(SEXP x, SEXP i);
 SEXP getSparseMatrix(SEXP x, SEXP i, SEXP j);
+SEXP rmatmulSparse(SEXP x, SEXP y);
+SEXP lmatmulSparse(SEXP x, SEXP y);
+SEXP rowDistSparse(SEXP x, SEXP y,
+	SEXP metric, SEXP p, SEXP weights);
+SEXP colDistSparse(SEXP x, SEXP y,
+	SEXP metric, SEXP p, SEXP weights);
+
+// Summary statistics
+//--------------------
+
+SEXP rowStats(SEXP x, SEXP stat, SEXP group,
+	SEXP ngroups, SEXP na_rm);
+SEXP colStats(SEXP x, SEXP stat, SEXP group,
+	SEXP ngroups, SEXP na_rm);
 
 // 1D Signal processing
 //----------------------
@@ -89,13 +123,15 @@ SEXP getSparseMatrix(SEXP x, SEXP i, SEXP j);
 SEXP meanFilter(SEXP x, SEXP width);
 SEXP linearFilter(SEXP x, SEXP weights);
 SEXP bilateralFilter(SEXP x, SEXP width,
-	SEXP sddist, SEXP sdrange, SEXP spar);
+	SEXP sddist, SEXP sdrange, SEXP spar, SEXP nlevels);
 SEXP diffusionFilter(SEXP x, SEXP niter,
 	SEXP kappa, SEXP rate, SEXP method);
 SEXP guidedFilter(SEXP x, SEXP g, SEXP width,
 	SEXP sdreg, SEXP ftol);
+SEXP filterMatrix(SEXP x, SEXP out, SEXP margin, SEXP method,
+	SEXP width, SEXP weights, SEXP params, SEXP nthreads);
 SEXP warpDTW(SEXP x, SEXP y, SEXP tx, SEXP ty,
-	SEXP tol, SEXP tol_ref);
+	SEXP tol, SEXP tol_ref, SEXP window, SEXP radius);
 SEXP warpCOW(SEXP x, SEXP y, SEXP tx, SEXP ty,
 	SEXP x_nodes, SEXP y_nodes, SEXP tol, SEXP tol_ref);
 SEXP iCor(SEXP x, SEXP y);
@@ -108,6 +144,10 @@ SEXP smoothSNIP(SEXP x, SEXP m, SEXP decreasing);
 SEXP localMaxima(SEXP x, SEXP width);
 SEXP peakBoundaries(SEXP x, SEXP peaks);
 SEXP peakBases(SEXP x, SEXP peaks);
+SEXP continuousWT(SEXP x, SEXP wavelets);
+SEXP findPeaksCWT(SEXP x, SEXP wavelets, SEXP maxdists, SEXP params);
+SEXP findPeaksCWTMatrix(SEXP x, SEXP margin, SEXP wavelets,
+	SEXP maxdists, SEXP params, SEXP nthreads);
 SEXP peakWidths(SEXP x, SEXP peaks, SEXP domain,
 	 SEXP left_limits, SEXP right_limits, SEXP heights);
 SEXP peakAreas(SEXP x, SEXP peaks, SEXP domain,
@@ -121,7 +161,7 @@ SEXP Approx1(SEXP xi, SEXP x, SEXP y,
 SEXP meanFilter2(SEXP x, SEXP width);
 SEXP linearFilter2(SEXP x, SEXP width);
 SEXP bilateralFilter2(SEXP x, SEXP width,
-	SEXP sddist, SEXP sdrange, SEXP spar);
+	SEXP sddist, SEXP sdrange, SEXP spar, SEXP nlevels);
 SEXP diffusionFilter2(SEXP x, SEXP niter,
 	SEXP kappa, SEXP rate, SEXP method);
 SEXP guidedFilter2(SEXP x, SEXP g, SEXP width,
@@ -1,9 +1,18 @@
 #ifndef DEFERRED_OPS
 #define DEFERRED_OPS
 
+#include <vector>
+
 #include "matterDefines.h"
 #include "coerce.h"
 
+// number of elements processed per block
+#define OPS_BLOCKSIZE 1024
+
+// number of elements staged as double at a time
+// when ops are applied before coercion
+#define OPS_STAGESIZE 65536
+
 //// DeferredOps class
 //---------------------
 
@@ -45,6 +54,45 @@ class DeferredOps : public ArrayInterface {
 				_nops = 0;	
 			}
 			_dim = dim;
+			compile();
+		}
+
+		// resolve the ops once before they are applied:
+		// look up the arg data pointers and types, and
+		// calculate the stride of each dimension
+		// (args are read in place, so this is O(nops))
+		void compile()
+		{
+			_s.resize(rank());
+			for ( int k = 0; k < rank(); k++ )
+				_s[k] = k ? _s[k - 1] * dim(k - 1) : 1;
+			_arglen.assign(nops(), 0);
+			_argtype.assign(nops(), NILSXP);
+			_argp.assign(nops(), NULL);
+			_grp.assign(nops(), NULL);
+			for ( int i = 0; i < nops(); i++ )
+			{
+				if ( is_unary(i) )
+					continue;
+				_arglen[i] = arglen(i);
+				_argtype[i] = argtype(i);
+				switch(_argtype[i]) {
+					case RAWSXP:
+						_argp[i] = RAW(arg(i));
+						break;
+					case LGLSXP:
+						_argp[i] = LOGICAL(arg(i));
+						break;
+					case INTSXP:
+						_argp[i] = INTEGER(arg(i));
+						break;
+					case REALSXP:
+						_argp[i] = REAL(arg(i));
+						break;
+				}
+				if ( is_grouped(i) )
+					_grp[i] = INTEGER(group(i));
+			}
 		}
 
 		int nops() {
@@ -144,6 +192,36 @@ class DeferredOps : public ArrayInterface {
 					return std::log1p(x);
 				case MATH_EXP:
 					return std::exp(x);
+				case MATH_SQRT:
+					return std::sqrt(x);
+				case MATH_ABS:
+					return x < 0 ? -x : x;
+				case MATH_FLOOR:
+					return std::floor(x);
+				case MATH_CEIL:
+					return std::ceil(x);
+				case MATH_TRUNC:
+					return std::trunc(x);
+				case MATH_ROUND:
+					return std::nearbyint(x);
+				case MATH_SIGN:
+					return (x > 0) - (x < 0);
+				case MATH_EXPM1:
+					return std::expm1(x);
+				case MATH_SIN:
+					return std::sin(x);
+				case MATH_COS:
+					return std::cos(x);
+				case MATH_TAN:
+					return std::tan(x);
+				case MATH_ASIN:
+					return std::asin(x);
+				case MATH_ACOS:
+					return std::acos(x);
+				case MATH_ATAN:
+					return std::atan(x);
+				case LGL_NOT:
+					return x == 0;
 				default:
 					return NA<T>();
 			}
@@ -167,165 +245,413 @@ class DeferredOps : public ArrayInterface {
 					return std::floor(x / y);
 				case OP_DIV:
 					return x / y;
+				case CMP_EQ:
+					return x == y;
+				case CMP_GT:
+					return x > y;
+				case CMP_LT:
+					return x < y;
+				case CMP_NE:
+					return x != y;
+				case CMP_LE:
+					return x <= y;
+				case CMP_GE:
+					return x >= y;
+				case LGL_AND:
+					return x != 0 && y != 0;
+				case LGL_OR:
+					return x != 0 || y != 0;
 				default:
 					return NA<T>();
 			}
 		}
 
+		// logical ops where NA doesn't always give NA
+		// (FALSE & NA is FALSE, and TRUE | NA is TRUE)
 		template<typename T>
-		size_t apply(T * x, index_t i, size_t size, int stride = 1)
+		T do_logic(T x, T y, int opcode)
+		{
+			bool xna = isNA(x), yna = isNA(y);
+			if ( opcode == LGL_AND ) {
+				if ( (!xna && x == 0) || (!yna && y == 0) )
+					return 0;
+			}
+			else {
+				if ( (!xna && x != 0) || (!yna && y != 0) )
+					return 1;
+			}
+			if ( xna || yna )
+				return NA<T>();
+			return do_binop<T>(x, y, opcode);
+		}
+
+		//// Fused kernels
+		//-----------------
+
+		// ops are applied one at a time to blocks of elements,
+		// so the opcode is dispatched once per block (not per
+		// element) and the inner loops can be vectorized
+
+		// apply a unary op to a block
+		template<typename T, int OP>
+		void unop_block(T * x, size_t n, int stride)
+		{
+			for ( size_t j = 0; j < n; j++ )
+			{
+				T xj = x[stride * j];
+				x[stride * j] = isNA(xj) ? xj : do_unop<T>(xj, OP);
+			}
+		}
+
+		// apply a binary op to a block with a scalar arg
+		template<typename T, int OP>
+		void binop_block(T * x, T y, size_t n, int stride, bool rhs)
+		{
+			if ( isNA(y) ) {
+				for ( size_t j = 0; j < n; j++ )
+					if ( !isNA(x[stride * j]) )
+						x[stride * j] = NA<T>();
+			}
+			else if ( rhs ) {
+				for ( size_t j = 0; j < n; j++ )
+				{
+					T xj = x[stride * j];
+					x[stride * j] = isNA(xj) ? xj : do_binop<T>(y, xj, OP);
+				}
+			}
+			else {
+				for ( size_t j = 0; j < n; j++ )
+				{
+					T xj = x[stride * j];
+					x[stride * j] = isNA(xj) ? xj : do_binop<T>(xj, y, OP);
+				}
+			}
+		}
+
+		// apply a binary op to a block with a vector of args
+		template<typename T, int OP>
+		void binop_block(T * x, const T * y, size_t n, int stride, bool rhs)
 		{
-			size_t n = 0;
-			int s [rank()];
-			int arr_ind [rank()];
-			// calculate stride for each dimension
-			for ( int k = 0; k < rank(); k++ ) {
-				if ( k )
-					s[k] = s[k - 1] * dim(k - 1);
+			for ( size_t j = 0; j < n; j++ )
+			{
+				T xj = x[stride * j], yj = y[j];
+				if ( isNA(xj) )
+					continue;
+				if ( isNA(yj) )
+					x[stride * j] = NA<T>();
+				else if ( rhs )
+					x[stride * j] = do_binop<T>(yj, xj, OP);
 				else
-					s[k] = 1;
+					x[stride * j] = do_binop<T>(xj, yj, OP);
+			}
+		}
+
+		// apply a logical op to a block (NA-aware)
+		template<typename T, int OP>
+		void logic_block(T * x, T y, size_t n, int stride, bool rhs)
+		{
+			for ( size_t j = 0; j < n; j++ )
+				x[stride * j] = do_logic<T>(x[stride * j], y, OP);
+		}
+
+		template<typename T, int OP>
+		void logic_block(T * x, const T * y, size_t n, int stride, bool rhs)
+		{
+			for ( size_t j = 0; j < n; j++ )
+				x[stride * j] = do_logic<T>(x[stride * j], y[j], OP);
+		}
+
+		template<typename T>
+		void unop(T * x, size_t n, int stride, int opcode)
+		{
+			switch(opcode) {
+				case MATH_LOG:
+					return unop_block<T,MATH_LOG>(x, n, stride);
+				case MATH_LOG10:
+					return unop_block<T,MATH_LOG10>(x, n, stride);
+				case MATH_LOG2:
+					return unop_block<T,MATH_LOG2>(x, n, stride);
+				case MATH_LOG1P:
+					return unop_block<T,MATH_LOG1P>(x, n, stride);
+				case MATH_EXP:
+					return unop_block<T,MATH_EXP>(x, n, stride);
+				case MATH_SQRT:
+					return unop_block<T,MATH_SQRT>(x, n, stride);
+				case MATH_ABS:
+					return unop_block<T,MATH_ABS>(x, n, stride);
+				case MATH_FLOOR:
+					return unop_block<T,MATH_FLOOR>(x, n, stride);
+				case MATH_CEIL:
+					return unop_block<T,MATH_CEIL>(x, n, stride);
+				case MATH_TRUNC:
+					return unop_block<T,MATH_TRUNC>(x, n, stride);
+				case MATH_ROUND:
+					return unop_block<T,MATH_ROUND>(x, n, stride);
+				case MATH_SIGN:
+					return unop_block<T,MATH_SIGN>(x, n, stride);
+				case MATH_EXPM1:
+					return unop_block<T,MATH_EXPM1>(x, n, stride);
+				case MATH_SIN:
+					return unop_block<T,MATH_SIN>(x, n, stride);
+				case MATH_COS:
+					return unop_block<T,MATH_COS>(x, n, stride);
+				case MATH_TAN:
+					return unop_block<T,MATH_TAN>(x, n, stride);
+				case MATH_ASIN:
+					return unop_block<T,MATH_ASIN>(x, n, stride);
+				case MATH_ACOS:
+					return unop_block<T,MATH_ACOS>(x, n, stride);
+				case MATH_ATAN:
+					return unop_block<T,MATH_ATAN>(x, n, stride);
+				case LGL_NOT:
+					return unop_block<T,LGL_NOT>(x, n, stride);
+				default:
+					return fill_na(x, n, stride);
+			}
+		}
+
+		// Ty is T (scalar arg) or const T * (vector of args)
+		template<typename T, typename Ty>
+		void binop(T * x, Ty y, size_t n, int stride, bool rhs, int opcode)
+		{
+			switch(opcode) {
+				case OP_ADD:
+					return binop_block<T,OP_ADD>(x, y, n, stride, rhs);
+				case OP_SUB:
+					return binop_block<T,OP_SUB>(x, y, n, stride, rhs);
+				case OP_MUL:
+					return binop_block<T,OP_MUL>(x, y, n, stride, rhs);
+				case OP_POW:
+					return binop_block<T,OP_POW>(x, y, n, stride, rhs);
+				case OP_MOD:
+					return binop_block<T,OP_MOD>(x, y, n, stride, rhs);
+				case OP_IDIV:
+					return binop_block<T,OP_IDIV>(x, y, n, stride, rhs);
+				case OP_DIV:
+					return binop_block<T,OP_DIV>(x, y, n, stride, rhs);
+				case CMP_EQ:
+					return binop_block<T,CMP_EQ>(x, y, n, stride, rhs);
+				case CMP_GT:
+					return binop_block<T,CMP_GT>(x, y, n, stride, rhs);
+				case CMP_LT:
+					return binop_block<T,CMP_LT>(x, y, n, stride, rhs);
+				case CMP_NE:
+					return binop_block<T,CMP_NE>(x, y, n, stride, rhs);
+				case CMP_LE:
+					return binop_block<T,CMP_LE>(x, y, n, stride, rhs);
+				case CMP_GE:
+					return binop_block<T,CMP_GE>(x, y, n, stride, rhs);
+				case LGL_AND:
+					return logic_block<T,LGL_AND>(x, y, n, stride, rhs);
+				case LGL_OR:
+					return logic_block<T,LGL_OR>(x, y, n, stride, rhs);
+				default:
+					return fill_na(x, n, stride);
 			}
-			// loop through region
-			for ( index_t j = 0; j < size; j++ )
+		}
+
+		template<typename T>
+		void fill_na(T * x, size_t n, int stride)
+		{
+			for ( size_t j = 0; j < n; j++ )
+				if ( !isNA(x[stride * j]) )
+					x[stride * j] = NA<T>();
+		}
+
+		// is the arg the same for every element?
+		bool is_scalar(int i) {
+			return _arglen[i] == 1 && !is_grouped(i);
+		}
+
+		// arg element read from the resolved arg pointers
+		template<typename T>
+		T argval(int i, index_t j, int grp = 0)
+		{
+			if ( isNA(grp) || isNA(j) )
+				return NA<T>();
+			index_t s = _arglen[i];
+			if ( s == 1 )
+				j = 0;
+			index_t k = s * grp + j;
+			switch(_argtype[i]) {
+				case RAWSXP:
+					return coerce_cast<T>(static_cast<const Rbyte*>(_argp[i])[k]);
+				case LGLSXP:
+				case INTSXP:
+					return coerce_cast<T>(static_cast<const int*>(_argp[i])[k]);
+				case REALSXP:
+					return coerce_cast<T>(static_cast<const double*>(_argp[i])[k]);
+				default:
+					return 0;
+			}
+		}
+
+		// stride and extent of a dim (rank 0 is treated as 1-d)
+		index_t dimstride(int k) {
+			return k < rank() ? _s[k] : 1;
+		}
+
+		index_t dimextent(int k) {
+			return k < rank() ? dim(k) : R_XLEN_T_MAX;
+		}
+
+		// fill args for the linear index range [i, i + n)
+		// (array indices are stepped incrementally)
+		template<typename T>
+		void fill_args(T * y, int l, index_t i, size_t n)
+		{
+			int da = argdim(l), dg = groupdim(l);
+			index_t sa = dimstride(da), na = dimextent(da);
+			index_t sg = dimstride(dg), ng = dimextent(dg);
+			index_t pa = i % sa, ca = (i / sa) % na;
+			index_t pg = i % sg, cg = (i / sg) % ng;
+			int * grp = _grp[l];
+			for ( size_t k = 0; k < n; k++ )
 			{
+				y[k] = argval<T>(l, ca, grp != NULL ? grp[cg] : 0);
+				if ( ++pa == sa ) {
+					pa = 0;
+					if ( ++ca == na )
+						ca = 0;
+				}
+				if ( ++pg == sg ) {
+					pg = 0;
+					if ( ++cg == ng )
+						cg = 0;
+				}
+			}
+		}
+
+		// fill args for arbitrary linear indices
+		template<typename T>
+		void fill_args(T * y, int l, SEXP indx, index_t offset, size_t n)
+		{
+			int da = argdim(l), dg = groupdim(l);
+			index_t sa = dimstride(da), na = dimextent(da);
+			index_t sg = dimstride(dg), ng = dimextent(dg);
+			int * grp = _grp[l];
+			for ( size_t k = 0; k < n; k++ )
+			{
+				index_t i = IndexElt(indx, offset + k);
+				if ( isNA(i) ) {
+					y[k] = NA<T>();
+					continue;
+				}
+				i--;
+				int g = grp != NULL ? grp[(i / sg) % ng] : 0;
+				y[k] = argval<T>(l, (i / sa) % na, g);
+			}
+		}
+
+		template<typename T>
+		size_t apply(T * x, index_t i, size_t size, int stride = 1)
+		{
+			std::vector<T> y(min2(size, static_cast<size_t>(OPS_BLOCKSIZE)));
+			for ( size_t j = 0; j < size; j += OPS_BLOCKSIZE )
+			{
+				size_t n = min2(size - j, static_cast<size_t>(OPS_BLOCKSIZE));
+				T * xj = x + stride * j;
 				for ( int l = 0; l < nops(); l++ )
 				{
-					T yj, xj = x[stride * j];
-					if ( isNA(xj) )
-						continue;
 					if ( is_unary(l) )
-					{
-						x[stride * j] = do_unop(xj, op(l));
-					}
-					else
-					{
-						// find array index corresponding to linear index
-						for ( int k = 0; k < rank(); k++ )
-							arr_ind[k] = ((i + j) / s[k]) % dim(k);
-						// get the corresponding group and arg element
-						int grp = group(l, arr_ind[groupdim(l)]);
-						yj = arg<T>(l, arr_ind[argdim(l)], grp);
-						// apply the op
-						if ( isNA(yj) ) {
-							x[stride * j] = NA<T>();
-							continue;
-						}
-						if ( is_rhs(l) ) {
-							T tmp = xj;
-							xj = yj;
-							yj = tmp;
-						}
-						x[stride * j] = do_binop(xj, yj, op(l));
+						unop(xj, n, stride, op(l));
+					else if ( is_scalar(l) )
+						binop(xj, argval<T>(l, 0), n, stride, is_rhs(l), op(l));
+					else {
+						fill_args(y.data(), l, i + j, n);
+						binop(xj, static_cast<const T*>(y.data()),
+							n, stride, is_rhs(l), op(l));
 					}
 				}
-				n++;
 			}
-			return n;
+			return size;
 		}
 
 		template<typename T>
 		size_t apply(T * x, SEXP indx, int stride = 1)
 		{
-			size_t n = 0;
-			R_xlen_t len = Rf_isNull(indx) ? length() : XLENGTH(indx);
-			int s [rank()];
-			int arr_ind [rank()];
-			// calculate stride for each dimension
-			for ( int k = 0; k < rank(); k++ ) {
-				if ( k )
-					s[k] = s[k - 1] * dim(k - 1);
-				else
-					s[k] = 1;
-			}
-			// loop through indices
-			for ( index_t j = 0; j < len; j++ )
+			if ( Rf_isNull(indx) )
+				return apply(x, 0, length(), stride);
+			size_t size = XLENGTH(indx);
+			std::vector<T> y(min2(size, static_cast<size_t>(OPS_BLOCKSIZE)));
+			for ( size_t j = 0; j < size; j += OPS_BLOCKSIZE )
 			{
+				size_t n = min2(size - j, static_cast<size_t>(OPS_BLOCKSIZE));
+				T * xj = x + stride * j;
 				for ( int l = 0; l < nops(); l++ )
 				{
-					T yj, xj = x[stride * j];
-					if ( isNA(xj) )
-						continue; // this should also catch NA index
 					if ( is_unary(l) )
-					{
-						x[stride * j]  = do_unop(xj, op(l));
-					}
-					else
-					{
-						index_t i = j;
-						if ( !Rf_isNull(indx) )
-							i = IndexElt(indx, j) - 1;
-						// find array index corresponding to linear index
-						for ( int k = 0; k < rank(); k++ )
-							arr_ind[k] = (i / s[k]) % dim(k);
-						// get the corresponding group and arg element
-						int grp = group(l, arr_ind[groupdim(l)]);
-						yj = arg<T>(l, arr_ind[argdim(l)], grp);
-						// apply the op
-						if ( isNA(yj) ) {
-							x[stride * j] = NA<T>();
-							continue;
-						}
-						if ( is_rhs(l) ) {
-							T tmp = xj;
-							xj = yj;
-							yj = tmp;
-						}
-						x[stride * j]  = do_binop(xj, yj, op(l));
+						unop(xj, n, stride, op(l));
+					else if ( is_scalar(l) )
+						binop(xj, argval<T>(l, 0), n, stride, is_rhs(l), op(l));
+					else {
+						fill_args(y.data(), l, indx, j, n);
+						binop(xj, static_cast<const T*>(y.data()),
+							n, stride, is_rhs(l), op(l));
 					}
 				}
-				n++;
 			}
-			return n;
+			return size;
 		}
 
 		template<typename T>
 		size_t apply(T * x, SEXP i, SEXP j, int stride = 1)
 		{
-			size_t n = 0;
-			int nr = Rf_isNull(i) ? nrow() : LENGTH(i);
-			int nc = Rf_isNull(j) ? ncol() : LENGTH(j);
+			index_t nr = Rf_isNull(i) ? nrow() : LENGTH(i);
+			index_t nc = Rf_isNull(j) ? ncol() : LENGTH(j);
 			stride = stride * nr;
+			std::vector<T> y(min2(static_cast<size_t>(nr),
+				static_cast<size_t>(OPS_BLOCKSIZE)));
 			for ( index_t jj = 0; jj < nc; jj++ )
 			{
-				for ( index_t ii = 0; ii < nr; ii++ )
+				index_t col = jj;
+				if ( !Rf_isNull(j) ) {
+					col = IndexElt(j, jj);
+					col = isNA(col) ? col : col - 1;
+				}
+				for ( index_t ii = 0; ii < nr; ii += OPS_BLOCKSIZE )
 				{
+					size_t n = min2(nr - ii, static_cast<index_t>(OPS_BLOCKSIZE));
+					T * xij = x + ii + stride * jj;
 					for ( int l = 0; l < nops(); l++ )
 					{
-						T yij, xij = x[ii + stride * jj];
-						if ( isNA(xij) )
-							continue;  // this should also catch NA index
-						if ( is_unary(l) )
-						{
-							x[ii + stride * jj] = do_unop(xij, op(l));
+						if ( is_unary(l) ) {
+							unop(xij, n, 1, op(l));
+							continue;
+						}
+						if ( is_scalar(l) ) {
+							binop(xij, argval<T>(l, 0), n, 1, is_rhs(l), op(l));
+							continue;
+						}
+						int * grp = _grp[l];
+						int gcol = NA_INTEGER;
+						if ( grp == NULL )
+							gcol = 0;
+						else if ( groupdim(l) && !isNA(col) )
+							gcol = grp[col];
+						if ( argdim(l) && (grp == NULL || groupdim(l)) ) {
+							// same arg for the whole column
+							binop(xij, argval<T>(l, col, gcol), n, 1, is_rhs(l), op(l));
+							continue;
 						}
-						else
+						for ( size_t k = 0; k < n; k++ )
 						{
-							index_t row = ii;
-							index_t col = jj;
-							if ( !Rf_isNull(i) )
-								row = IndexElt(i, ii) - 1;
-							if ( !Rf_isNull(j) )
-								col = IndexElt(j, jj) - 1;
-							// get the group and arg element for this row/col
-							int grp = groupdim(l) ? group(l, col) : group(l, row);
-							yij = argdim(l) ? arg<T>(l, col, grp) : arg<T>(l, row, grp);
-							// apply the op
-							if ( isNA(yij) ) {
-								x[ii + stride * jj] = NA<T>();
-								continue;
-							}
-							if ( is_rhs(l) ) {
-								T tmp = xij;
-								xij = yij;
-								yij = tmp;
+							index_t row = ii + k;
+							if ( !Rf_isNull(i) ) {
+								row = IndexElt(i, ii + k);
+								row = isNA(row) ? row : row - 1;
 							}
-							x[ii + stride * jj] = do_binop(xij, yij, op(l));
+							int g = gcol;
+							if ( grp != NULL && !groupdim(l) )
+								g = isNA(row) ? NA_INTEGER : grp[row];
+							y[k] = argdim(l) ? argval<T>(l, col, g) : argval<T>(l, row, g);
 						}
+						binop(xij, static_cast<const T*>(y.data()),
+							n, 1, is_rhs(l), op(l));
 					}
-					n++;
 				}
 			}
-			return n;
+			return nr * nc;
 		}
 
 	protected:
@@ -336,6 +662,11 @@ class DeferredOps : public ArrayInterface {
 		int * _rhs;
 		int * _margins;
 		SEXP _group;
+		std::vector<index_t> _s; // dim strides
+		std::vector<index_t> _arglen;
+		std::vector<SEXPTYPE> _argtype;
+		std::vector<const void *> _argp; // arg data (read in place)
+		std::vector<int *> _grp;
 
 };
 
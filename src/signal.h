@@ -1,6 +1,8 @@
 #ifndef SIGNAL
 #define SIGNAL
 
+#include <vector>
+
 #include "matterDefines.h"
 #include "coerce.h"
 #include "search.h"
@@ -35,6 +37,16 @@
 #define DIFF_EQ2	2 // Perona-Malik #2
 #define DIFF_PAW	3 // Peak-aware weighting
 
+// maximum range levels for approximate bilateral filtering
+#define BILATERAL_MAXLEVELS 256
+
+// dynamic time warping windows
+#define DTW_BAND	1 // Sakoe-Chiba band (|tx - ty| <= tol)
+#define DTW_ITAKURA	2 // Itakura parallelogram (within the band)
+
+// maximum slope of the Itakura parallelogram
+#define DTW_MAXSLOPE 2
+
 // wrap index to simulate signal wraparound
 #define wrap_ind(i, n) ((i) < 0 ? (i) % (n) + (n) : (i) % (n))
 
@@ -228,11 +240,13 @@ double do_mad(T * x, index_t lower, index_t upper)
 	return quick_mad(x + lower, n);
 }
 
+// quantile of x[lower..upper] (uses buffer as workspace if given)
 template<typename T>
-double do_quant(T * x, index_t lower, index_t upper, double prob)
+double do_quant(T * x, index_t lower, index_t upper, double prob,
+	T * buffer = NULL)
 {
 	index_t n = upper - lower + 1;
-	T * dup = R_Calloc(n, T);
+	T * dup = buffer != NULL ? buffer : R_Calloc(n, T);
 	std::memcpy(dup, x + lower, n * sizeof(T));
 	// stats::quantile type 3 (nearest order statistic)
 	size_t len = do_len(x, lower, upper);
@@ -244,7 +258,8 @@ double do_quant(T * x, index_t lower, index_t upper, double prob)
 		k = j - 1;
 	// find the kth order statistic by sorting x
 	T q = quick_select(dup, 0, n, norm_ind(k, n));
-	Free(dup);
+	if ( buffer == NULL )
+		Free(dup);
 	return coerce_cast<double>(q);
 }
 
@@ -287,7 +302,7 @@ double do_klanczos1(Tx xi, Tx * x, Ty * y, double a,
 //---------------------------
 
 template<typename T>
-void mean_filter(T * x, size_t n, int width, double * buffer)
+void mean_filter(T * x, index_t n, int width, double * buffer)
 {
 	int r = width / 2;
 	index_t ij, prev, lo, hi;
@@ -334,7 +349,7 @@ void mean_filter(T * x, size_t n, int width, double * buffer)
 }
 
 template<typename T>
-void linear_filter(T * x, size_t n,
+void linear_filter(T * x, index_t n,
 	double * weights, int width, double * buffer)
 {
 	int r = width / 2;
@@ -360,8 +375,15 @@ void linear_filter(T * x, size_t n,
 	}
 }
 
+// spatial gaussian weights for offsets 0, ..., r
+inline void kgaussian_lut(int r, double sd, double * weights)
+{
+	for ( int j = 0; j <= r; j++ )
+		weights[j] = kgaussian(j, sd);
+}
+
 template<typename T>
-void bilateral_filter(T * x, size_t n, int width,
+void bilateral_filter(T * x, index_t n, int width,
 	double sddist, double sdrange, double spar, double * buffer)
 {
 	int r = width / 2;
@@ -369,7 +391,9 @@ void bilateral_filter(T * x, size_t n, int width,
 	double sdd = sddist, sdr = sdrange;
 	double xmedian, xmad, xrange;
 	double D = r;
-	if ( !isNA(spar) )
+	std::vector<double> wtdist(r + 1), dxs;
+	bool adaptive = !isNA(spar);
+	if ( adaptive )
 	{
 		// get MAD if using adaptive parameters
 		xmedian = quick_median(x, n);
@@ -377,7 +401,32 @@ void bilateral_filter(T * x, size_t n, int width,
 		double xmin = do_min(x, 0, n - 1);
 		double xmax = do_max(x, 0, n - 1);
 		xrange = xmax - xmin;
+		// sliding sums of the local differences
+		dxs.resize(n);
+		double s = 0;
+		for ( index_t i = 0; i < n; i++ )
+		{
+			if ( i == 0 ) {
+				for ( index_t j = -r; j <= r; j++ )
+				{
+					ij = norm_ind(j, n);
+					if ( !isNA(x[ij]) )
+						s += std::fabs(x[ij] - xmedian);
+				}
+			}
+			else {
+				index_t prev = norm_ind(i - r - 1, n);
+				index_t next = norm_ind(i + r, n);
+				if ( !isNA(x[prev]) )
+					s -= std::fabs(x[prev] - xmedian);
+				if ( !isNA(x[next]) )
+					s += std::fabs(x[next] - xmedian);
+			}
+			dxs[i] = s;
+		}
 	}
+	if ( !adaptive || !isNA(sddist) )
+		kgaussian_lut(r, sdd, wtdist.data());
 	for ( index_t i = 0; i < n; i++ )
 	{
 		if ( isNA(x[i]) )
@@ -385,23 +434,19 @@ void bilateral_filter(T * x, size_t n, int width,
 			buffer[i] = NA_REAL;
 			continue;
 		}
-		double dx = 0, W = 0;
+		double W = 0;
 		buffer[i] = 0;
-		if ( !isNA(spar) )
+		if ( adaptive )
 		{
 			// modified version of Joseph & Periyasamy (2018)
-			for ( index_t j = -r; j <= r; j++ )
-			{
-				// find mean of local differences
-				ij = norm_ind(i + j, n);
-				if ( !isNA(x[ij]) )
-					dx += std::fabs(x[ij] - xmedian);
-			}
-			dx /= width;
+			// (find mean of local differences)
+			double dx = dxs[i] / width;
 			// calculate adaptive parameters
 			double z = std::fabs(dx - xmad) / spar;
-			if ( isNA(sddist) )
+			if ( isNA(sddist) ) {
 				sdd = D * std::exp(-z) / std::sqrt(2);
+				kgaussian_lut(r, sdd, wtdist.data());
+			}
 			if ( isNA(sdrange) )
 				sdr = xrange * std::exp(-z) / std::sqrt(2);
 		}
@@ -417,18 +462,127 @@ void bilateral_filter(T * x, size_t n, int width,
 			ij = norm_ind(i + j, n);
 			if ( isNA(x[ij]) )
 				continue;
-			double wtdist = kgaussian(j, sdd);
+			double wtd = wtdist[j < 0 ? -j : j];
 			double wtrange = kgaussian(x[ij] - x[i], sdr);
-			buffer[i] += wtdist * wtrange * x[ij];
-			W += wtdist * wtrange;
+			buffer[i] += wtd * wtrange * x[ij];
+			W += wtd * wtrange;
 		}
 		if ( !isNA(buffer[i]) )
 			buffer[i] /= W;
 	}
 }
 
+// width of a box filter that approximates a gaussian
+// filter when applied 3 times (must be odd)
+inline int box_width(double sd)
+{
+	double w = std::sqrt(4 * sd * sd + 1);
+	return 1 + 2 * static_cast<int>(std::floor((w - 1) / 2 + 0.5));
+}
+
+// number of range levels for the approximate bilateral filter
+inline int bilateral_levels(double xrange, double sdrange, int nlevels)
+{
+	if ( isNA(nlevels) || nlevels < 2 ) {
+		double k = std::ceil(xrange / sdrange) + 1;
+		nlevels = static_cast<int>(min2(k, BILATERAL_MAXLEVELS));
+	}
+	return max2(nlevels, 2);
+}
+
+// piecewise-linear approximation of the bilateral filter
+// (Durand & Dorsey, 2002): the signal is filtered with a
+// range kernel centered at each of 'nlevels' fixed values,
+// and each sample is interpolated between the nearest two;
+// the spatial gaussian is approximated by 3 box filters,
+// so the cost per sample does not depend on the width
+// ('smooth(y, width, z)' box filters y into z, so the
+// same code serves signals and images)
+template<typename T, typename F>
+void bilateral_approx(T * x, size_t n, double sddist,
+	double sdrange, int nlevels, double * buffer, F smooth)
+{
+	double xmin = R_PosInf, xmax = R_NegInf;
+	for ( size_t i = 0; i < n; i++ )
+	{
+		if ( !isNA(x[i]) ) {
+			xmin = min2(xmin, x[i]);
+			xmax = max2(xmax, x[i]);
+		}
+	}
+	if ( !(xmax > xmin) || !std::isfinite(xmax - xmin) ||
+		sddist <= DBL_EPSILON || sdrange <= DBL_EPSILON )
+	{
+		// nothing to filter (or avoid singularities)
+		for ( size_t i = 0; i < n; i++ )
+			buffer[i] = isNA(x[i]) ? NA_REAL : x[i];
+		return;
+	}
+	nlevels = bilateral_levels(xmax - xmin, sdrange, nlevels);
+	int width = box_width(sddist);
+	double step = (xmax - xmin) / (nlevels - 1);
+	std::vector<double> u(4 * n);
+	double * wt = u.data();
+	double * wx = wt + n;
+	double * prev = wx + n;
+	double * curr = prev + n;
+	for ( int k = 0; k < nlevels; k++ )
+	{
+		double lk = xmin + k * step;
+		for ( size_t i = 0; i < n; i++ )
+		{
+			if ( isNA(x[i]) ) {
+				wt[i] = 0;
+				wx[i] = 0;
+			}
+			else {
+				wt[i] = kgaussian(x[i] - lk, sdrange);
+				wx[i] = wt[i] * x[i];
+			}
+		}
+		for ( int pass = 0; pass < 3; pass++ )
+		{
+			smooth(wt, width, curr);
+			std::memcpy(wt, curr, n * sizeof(double));
+			smooth(wx, width, curr);
+			std::memcpy(wx, curr, n * sizeof(double));
+		}
+		for ( size_t i = 0; i < n; i++ )
+			curr[i] = wt[i] > 0 ? wx[i] / wt[i] : static_cast<double>(x[i]);
+		if ( k > 0 )
+		{
+			// interpolate samples between the last two levels
+			double lj = lk - step;
+			for ( size_t i = 0; i < n; i++ )
+			{
+				if ( isNA(x[i]) )
+					buffer[i] = NA_REAL;
+				else if ( (x[i] >= lj && x[i] <= lk) || (k == nlevels - 1 && x[i] > lk) )
+				{
+					double t = (x[i] - lj) / step;
+					t = min2(max2(t, 0.0), 1.0);
+					buffer[i] = (1 - t) * prev[i] + t * curr[i];
+				}
+			}
+		}
+		double * tmp = prev;
+		prev = curr;
+		curr = tmp;
+	}
+}
+
+template<typename T>
+void bilateral_filter_fast(T * x, size_t n, double sddist,
+	double sdrange, int nlevels, double * buffer)
+{
+	bilateral_approx(x, n, sddist, sdrange, nlevels, buffer,
+		[&](double * y, int width, double * z) {
+			mean_filter(y, n, width, z);
+		});
+}
+
 template<typename T>
-void diffusion_filter(T * x, size_t n, int niter,
+void diffusion_filter(T * x, index_t n, int niter,
 	double K, double rate, int method, double * buffer)
 {
 	index_t L, R;
@@ -582,97 +736,49 @@ void guided_filter(T * x, T * g, size_t n, int width,
 //// Warping and alignment
 //--------------------------
 
-template<typename Tx, typename Tt>
-void warp_dtw(Tx * x, Tx * y, Tt * tx, Tt * ty, int nx, int ny,
-	int * i_buffer, int * j_buffer)
+// cost matrices are stored sparsely by row: row i (1-based) holds
+// columns wa[i] <= j < wb[i], and row 0 holds only D[0, 0] = 0
+
+// widen windows (if needed) so that a warping path exists:
+// windows must connect to the previous row and end at (nx, ny)
+inline void dtw_fix_window(int * wa, int * wb, int nx, int ny)
 {
-	// initialize output
-	for ( index_t k = 0; k < nx + ny - 1; k++ )
-	{
-		i_buffer[k] = NA_INTEGER;
-		j_buffer[k] = NA_INTEGER;
-	}
-	// fill cost matrix
-	double * D = R_Calloc((nx + 1) * (ny + 1), double);
-	for ( index_t i = 0; i <= nx; i++ )
-	{
-		for (index_t j = 0; j <= ny; j++ )
-			D[j * nx + i] = R_PosInf;
-	}
-	D[0] = 0;
-	double d, d00, d01, d10;
+	wa[0] = 0;
+	wb[0] = 1;
 	for ( index_t i = 1; i <= nx; i++ )
 	{
-		for (index_t j = 1; j <= ny; j++ )
-		{
-			d = udiff(x[i - 1], y[j - 1]);
-			d01 = D[j * nx + (i - 1)];
-			d10 = D[(j - 1) * nx + i];
-			d00 = D[(j - 1) * nx + (i - 1)];
-			if ( d01 < d00 && d01 < d10 )
-				D[j * nx + i] = (d * d) + d01;
-			else if ( d10 < d00 && d10 < d01 )
-				D[j * nx + i] = (d * d) + d10;
-			else
-				D[j * nx + i] = (d * d) + d00;
-		}
+		wa[i] = max2(wa[i], 1);
+		wb[i] = min2(max2(wb[i], wb[i - 1]), ny + 1);
+		wa[i] = min2(wa[i], wb[i - 1]);
 	}
-	// find optimal path
-	index_t i = nx - 1, j = ny - 1, k = 0;
-	while ( i >= 0 && j >= 0 && k < nx + ny - 1 )
-	{
-		i_buffer[k] = i;
-		j_buffer[k] = j;
-		d01 = D[(j + 1) * nx + i];
-		d10 = D[j * nx + (i + 1)];
-		d00 = D[j * nx + i];
-		if ( d01 < d00 && d01 < d10 )
-			i--;
-		else if ( d10 < d00 && d10 < d01 )
-			j--;
-		else
-		{
-			i--;
-			j--;
-		}
-		k++;
-	}
-	Free(D);
+	wb[nx] = ny + 1;
 }
 
-template<typename Tx, typename Tt>
-void warp_dtwc(Tx * x, Tx * y, Tt * tx, Tt * ty, int nx, int ny,
-	int * i_buffer, int * j_buffer, double tol, int tol_ref = ABS_DIFF)
+// windows where |tx - ty| <= tol (or all of y if tol is large)
+// returns false if the window is empty for some x
+template<typename Tt>
+bool dtw_band_window(Tt * tx, Tt * ty, int nx, int ny,
+	double tol, int tol_ref, int * wa, int * wb)
 {
-	// check tolerance window
 	if ( tol >= udiff(tx[0], ty[ny - 1], tol_ref) ||
 		tol >= udiff(tx[nx - 1], ty[0], tol_ref) )
 	{
-		return warp_dtw(x, y, tx, ty, nx, ny, i_buffer, j_buffer);
+		for ( index_t i = 1; i <= nx; i++ )
+		{
+			wa[i] = 1;
+			wb[i] = ny + 1;
+		}
+		return true;
 	}
 	tol = max2(tol, udiff(tx[nx - 1], ty[ny - 1], tol_ref));
-	// initialize output
-	for ( index_t k = 0; k < nx + ny - 1; k++ )
-	{
-		i_buffer[k] = NA_INTEGER;
-		j_buffer[k] = NA_INTEGER;
-	}
-	// allocate buffers for sparse matrix pointers
-	int * ptrs = R_Calloc(3 * (nx + 1), int);
-	int * pD = ptrs;
-	int * wa = ptrs + (nx + 1);
-	int * wb = ptrs + 2 * (nx + 1);
-	// find windows where |tx - ty| <= tol
-	int nD = 1;
-	pD[0] = 0, wa[0] = 0, wb[0] = 1;
 	for ( index_t i = 0; i < nx; i++ )
 	{
 		index_t j = binary_search(tx[i], ty,
 			0, ny, tol, tol_ref, NA_INTEGER);
+		if ( isNA(j) )
+			return false;
 		wa[i + 1] = j;
 		wb[i + 1] = j;
-		if ( isNA(j) )
-			Rf_error("tolerance window too small");
 		for ( index_t k = j - 1; k >= 0; k-- ) {
 			if ( udiff(tx[i], ty[k], tol_ref) > tol )
 				break;
@@ -685,8 +791,71 @@ void warp_dtwc(Tx * x, Tx * y, Tt * tx, Tt * ty, int nx, int ny,
 		}
 		wa[i + 1]++;
 		wb[i + 1]++;
-		pD[i + 1] = nD;
-		nD += wb[i + 1] - wa[i + 1];
+	}
+	return true;
+}
+
+// restrict windows to the Itakura parallelogram with
+// slopes between 1 / DTW_MAXSLOPE and DTW_MAXSLOPE
+inline void dtw_itakura_window(int nx, int ny, int * wa, int * wb)
+{
+	if ( nx < 2 || ny < 2 )
+		return;
+	double s = DTW_MAXSLOPE, u, lo, hi, diag;
+	for ( index_t i = 0; i < nx; i++ )
+	{
+		u = static_cast<double>(i) / (nx - 1);
+		lo = max2(u / s, 1 - s * (1 - u)) * (ny - 1);
+		hi = min2(s * u, 1 - (1 - u) / s) * (ny - 1);
+		// always keep the diagonal
+		diag = std::round(u * (ny - 1));
+		lo = min2(std::ceil(lo - DBL_EPSILON), diag);
+		hi = max2(std::floor(hi + DBL_EPSILON), diag);
+		wa[i + 1] = max2(wa[i + 1], static_cast<int>(lo) + 1);
+		wb[i + 1] = min2(wb[i + 1], static_cast<int>(hi) + 2);
+		if ( wa[i + 1] >= wb[i + 1] ) {
+			wa[i + 1] = static_cast<int>(diag) + 1;
+			wb[i + 1] = static_cast<int>(diag) + 2;
+		}
+	}
+}
+
+// windows for a DTW_BAND or DTW_ITAKURA window
+// returns false if the tolerance window is too small
+template<typename Tt>
+bool dtw_window(Tt * tx, Tt * ty, int nx, int ny, double tol,
+	int tol_ref, int window, int * wa, int * wb)
+{
+	if ( !dtw_band_window(tx, ty, nx, ny, tol, tol_ref, wa, wb) )
+		return false;
+	if ( window == DTW_ITAKURA )
+		dtw_itakura_window(nx, ny, wa, wb);
+	dtw_fix_window(wa, wb, nx, ny);
+	return true;
+}
+
+// dynamic time warping within windows wa[i] <= j < wb[i]
+// (using memory proportional to the total window size);
+// the path is returned from the end in i_buffer and j_buffer
+template<typename Tx>
+void dtw_windowed(Tx * x, Tx * y, int nx, int ny,
+	int * wa, int * wb, int * i_buffer, int * j_buffer)
+{
+	// initialize output
+	for ( index_t k = 0; k < nx + ny - 1; k++ )
+	{
+		i_buffer[k] = NA_INTEGER;
+		j_buffer[k] = NA_INTEGER;
+	}
+	// row pointers of the (sparse) cost matrix
+	dtw_fix_window(wa, wb, nx, ny);
+	size_t * pD = R_Calloc(nx + 1, size_t);
+	size_t nD = 1;
+	pD[0] = 0;
+	for ( index_t i = 1; i <= nx; i++ )
+	{
+		pD[i] = nD;
+		nD += wb[i] - wa[i];
 	}
 	// fill (sparse) cost matrix
 	double * D = R_Calloc(nD, double);
@@ -740,10 +909,157 @@ void warp_dtwc(Tx * x, Tx * y, Tt * tx, Tt * ty, int nx, int ny,
 		}
 		k++;
 	}
-	Free(ptrs);
+	Free(pD);
 	Free(D);
 }
 
+// unconstrained dynamic time warping
+template<typename Tx, typename Tt>
+void warp_dtw(Tx * x, Tx * y, Tt * tx, Tt * ty, int nx, int ny,
+	int * i_buffer, int * j_buffer)
+{
+	int * w = R_Calloc(2 * (nx + 1), int);
+	int * wa = w;
+	int * wb = w + (nx + 1);
+	for ( index_t i = 1; i <= nx; i++ )
+	{
+		wa[i] = 1;
+		wb[i] = ny + 1;
+	}
+	dtw_windowed(x, y, nx, ny, wa, wb, i_buffer, j_buffer);
+	Free(w);
+}
+
+// average adjacent pairs (the last element is kept if n is odd)
+template<typename T>
+void dtw_coarsen(T * x, int n, double * buffer)
+{
+	for ( index_t i = 0; i < n; i += 2 )
+	{
+		if ( i + 1 < n )
+			buffer[i / 2] = 0.5 * (static_cast<double>(x[i]) + x[i + 1]);
+		else
+			buffer[i / 2] = x[i];
+	}
+}
+
+// multiscale (FastDTW) warping: warp signals coarsened by half,
+// then refine within the projected coarse path expanded by radius
+// (and within the band or Itakura window where that is feasible)
+template<typename Tx, typename Tt>
+void warp_dtw_multiscale(Tx * x, Tx * y, Tt * tx, Tt * ty, int nx, int ny,
+	int * i_buffer, int * j_buffer, double tol, int tol_ref,
+	int window, int radius)
+{
+	int * w = R_Calloc(4 * (nx + 1), int);
+	int * wa = w;
+	int * wb = w + (nx + 1);
+	if ( nx <= radius + 2 || ny <= radius + 2 )
+	{
+		// solve the coarsest level directly
+		if ( !dtw_window(tx, ty, nx, ny, tol, tol_ref, window, wa, wb) ) {
+			for ( index_t i = 1; i <= nx; i++ )
+			{
+				wa[i] = 1;
+				wb[i] = ny + 1;
+			}
+		}
+		dtw_windowed(x, y, nx, ny, wa, wb, i_buffer, j_buffer);
+		Free(w);
+		return;
+	}
+	// warp the coarsened signals
+	int mx = (nx + 1) / 2, my = (ny + 1) / 2, np = mx + my - 1;
+	double * xc = R_Calloc(2 * (mx + my), double);
+	double * yc = xc + mx;
+	double * txc = yc + my;
+	double * tyc = txc + mx;
+	dtw_coarsen(x, nx, xc);
+	dtw_coarsen(y, ny, yc);
+	dtw_coarsen(tx, nx, txc);
+	dtw_coarsen(ty, ny, tyc);
+	int * path = R_Calloc(2 * np, int);
+	warp_dtw_multiscale(xc, yc, txc, tyc, mx, my,
+		path, path + np, tol, tol_ref, window, radius);
+	Free(xc);
+	// project the coarse path onto the rows
+	int * lo = w + 2 * (nx + 1);
+	int * hi = w + 3 * (nx + 1);
+	for ( index_t i = 0; i < nx; i++ )
+	{
+		lo[i] = ny;
+		hi[i] = -1;
+	}
+	for ( index_t k = 0; k < np && !isNA(path[k]); k++ )
+	{
+		index_t i = 2 * path[k], j = 2 * path[np + k];
+		for ( index_t r = i; r < i + 2 && r < nx; r++ )
+		{
+			lo[r] = min2(lo[r], j);
+			hi[r] = max2(hi[r], min2(j + 1, ny - 1));
+		}
+	}
+	Free(path);
+	// expand the projected path by radius
+	for ( index_t i = 0; i < nx; i++ )
+	{
+		int a = ny, b = -1;
+		index_t r0 = max2(i - radius, 0), r1 = min2(i + radius, nx - 1);
+		for ( index_t r = r0; r <= r1; r++ )
+		{
+			a = min2(a, lo[r]);
+			b = max2(b, hi[r]);
+		}
+		wa[i + 1] = max2(a - radius, 0) + 1;
+		wb[i + 1] = min2(b + radius, ny - 1) + 2;
+	}
+	// intersect with the band or Itakura window if possible
+	if ( dtw_window(tx, ty, nx, ny, tol, tol_ref, window, lo, hi) )
+	{
+		bool feasible = true;
+		for ( index_t i = 1; i <= nx; i++ )
+		{
+			if ( max2(wa[i], lo[i]) >= min2(wb[i], hi[i]) ) {
+				feasible = false;
+				break;
+			}
+		}
+		if ( feasible ) {
+			for ( index_t i = 1; i <= nx; i++ )
+			{
+				wa[i] = max2(wa[i], lo[i]);
+				wb[i] = min2(wb[i], hi[i]);
+			}
+		}
+	}
+	dtw_windowed(x, y, nx, ny, wa, wb, i_buffer, j_buffer);
+	Free(w);
+}
+
+// dynamic time warping constrained to a band where
+// |tx - ty| <= tol (optionally within an Itakura parallelogram),
+// or multiscale warping if radius > 0
+template<typename Tx, typename Tt>
+void warp_dtwc(Tx * x, Tx * y, Tt * tx, Tt * ty, int nx, int ny,
+	int * i_buffer, int * j_buffer, double tol, int tol_ref = ABS_DIFF,
+	int window = DTW_BAND, int radius = 0)
+{
+	if ( window != DTW_BAND && window != DTW_ITAKURA )
+		Rf_error("unsupported window type");
+	if ( radius > 0 )
+		return warp_dtw_multiscale(x, y, tx, ty, nx, ny,
+			i_buffer, j_buffer, tol, tol_ref, window, radius);
+	int * w = R_Calloc(2 * (nx + 1), int);
+	int * wa = w;
+	int * wb = w + (nx + 1);
+	if ( !dtw_window(tx, ty, nx, ny, tol, tol_ref, window, wa, wb) ) {
+		Free(w);
+		Rf_error("tolerance window too small");
+	}
+	dtw_windowed(x, y, nx, ny, wa, wb, i_buffer, j_buffer);
+	Free(w);
+}
+
 // correlation between x and y (w/ interpolation)
 template<typename T>
 double icor(T * x, T * y, size_t nx, size_t ny)
@@ -1229,7 +1545,7 @@ size_t local_maxima(T * x, size_t n, int * buffer, int width = 5)
 
 // find left boundary of a peak
 template<typename T>
-index_t peak_lbound(T * x, index_t peak, size_t n)
+index_t peak_lbound(T * x, index_t peak, index_t n)
 {
 	index_t lbound = peak;
 	// account for mis-centered peaks
@@ -1267,7 +1583,7 @@ index_t peak_lbound(T * x, index_t peak, size_t n)
 
 // find right boundary of a peak
 template<typename T>
-index_t peak_rbound(T * x, index_t peak, size_t n)
+index_t peak_rbound(T * x, index_t peak, index_t n)
 {
 	index_t rbound = peak;
 	// account for mis-centered peaks
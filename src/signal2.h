@@ -2,6 +2,7 @@
 #define SIGNAL2
 
 #include "matterDefines.h"
+#include "threads.h"
 #include "search.h"
 #include "signal.h"
 
@@ -146,151 +147,354 @@ double do_klanczos2(Txy xi, Txy yi, Txy * x, Txy * y, Tz * z,
 //// Filtering and smoothing
 //---------------------------
 
+// minimum pixels per thread for 2D filters
+#define FILTER2_MINPIXELS 65536
+
+// number of threads to use for filtering an image
+inline int filter2_threads(int nthreads, int nr, int nc)
+{
+	size_t n = static_cast<size_t>(nr) * nc;
+	size_t nmax = n / FILTER2_MINPIXELS;
+	nmax = min2(nmax, static_cast<size_t>(min2(nr, nc)));
+	if ( nthreads < 1 || nmax < 2 )
+		return 1;
+	return min2(static_cast<size_t>(nthreads), nmax);
+}
+
+// check that an image has no missing or infinite values
+// (filters can use the fast paths that skip NA checks)
+template<typename T>
+bool is_finite2(T * x, size_t n)
+{
+	for ( size_t i = 0; i < n; i++ )
+	{
+		if ( isNA(x[i]) || !std::isfinite(static_cast<double>(x[i])) )
+			return false;
+	}
+	return true;
+}
+
+// y[i] += w * x[i + k] for i = 0, ..., n - 1 (clamping at the ends)
 template<typename T>
-void mean_filter2(T * x, int nr, int nc, int width, double * buffer)
+inline void shift_add(T * x, index_t n, index_t k, double w, double * y)
+{
+	index_t lo = min2(max2(-k, 0), n);
+	index_t hi = max2(min2(n - k, n), lo);
+	for ( index_t i = 0; i < lo; i++ )
+		y[i] += w * x[norm_ind(i + k, n)];
+	// interior (branch-free)
+	for ( index_t i = lo; i < hi; i++ )
+		y[i] += w * x[i + k];
+	for ( index_t i = hi; i < n; i++ )
+		y[i] += w * x[norm_ind(i + k, n)];
+}
+
+// if the weights (a width x width matrix) are the outer product
+// of a column and row vector, then get them (as u and v)
+inline bool separate_weights(double * weights, int width, double * u, double * v)
+{
+	int p = 0;
+	for ( int k = 0; k < width * width; k++ )
+	{
+		if ( std::fabs(weights[k]) > std::fabs(weights[p]) )
+			p = k;
+	}
+	double wp = weights[p];
+	if ( wp == 0 || !std::isfinite(wp) )
+		return false;
+	int pi = p % width, pj = p / width;
+	for ( int k = 0; k < width; k++ )
+	{
+		u[k] = weights[pj * width + k];
+		v[k] = weights[k * width + pi] / wp;
+	}
+	double tol = 64 * DBL_EPSILON * std::fabs(wp);
+	for ( int kj = 0; kj < width; kj++ )
+	{
+		for ( int ki = 0; ki < width; ki++ )
+		{
+			if ( std::fabs(u[ki] * v[kj] - weights[kj * width + ki]) > tol )
+				return false;
+		}
+	}
+	return true;
+}
+
+template<typename T>
+void mean_filter2(T * x, int nr, int nc, int width,
+	double * buffer, int nthreads = 1)
 {
 	int r = width / 2;
-	index_t ii, jj, prev, next;
 	double * y = R_Calloc(nr * nc, double);
 	double * z = buffer;
-	// horizontal filter pass
-	for ( index_t i = 0; i < nr; i++ )
-	{
-		for ( index_t j = 0; j < nc; j++ )
+	bool finite = is_finite2(x, static_cast<size_t>(nr) * nc);
+	nthreads = filter2_threads(nthreads, nr, nc);
+	// horizontal filter pass (over bands of rows)
+	run_bands(nthreads, nr, [&](index_t i0, index_t i1) {
+		index_t jj, prev, next;
+		if ( finite )
 		{
-			prev = norm_ind(j - r - 1, nc);
-			next = norm_ind(j + r, nc);
-			if ( isNA(x[j * nr + i]) )
-			{
-				// handle missing pixel
-				y[j * nr + i] = NA_REAL;
-			}
-			else if ( j == 0 || isNA(y[(j - 1) * nr + i]) ||
-				isNA(x[prev * nr + i]) || isNA(x[next * nr + i]) )
+			// slide down whole columns so the inner loop is contiguous
+			for ( index_t j = 0; j < nc; j++ )
 			{
-				// handle missing neighborhood
-				double xs = 0;
-				size_t len = 0;
-				for ( index_t k = -r; k <= r; k++ )
+				double * yj = y + j * nr;
+				if ( j == 0 )
 				{
-					jj = norm_ind(j + k, nc);
-					if ( !isNA(x[jj * nr + i]) )
+					for ( index_t i = i0; i < i1; i++ )
 					{
-						xs += x[jj * nr + i];
-						len++;
+						double xs = 0;
+						for ( index_t k = -r; k <= r; k++ )
+							xs += x[norm_ind(k, nc) * nr + i];
+						yj[i] = width * (xs / width);
 					}
 				}
-				y[j * nr + i] = width * (xs / len);
+				else
+				{
+					T * xprev = x + norm_ind(j - r - 1, nc) * nr;
+					T * xnext = x + norm_ind(j + r, nc) * nr;
+					double * yprev = yj - nr;
+					for ( index_t i = i0; i < i1; i++ )
+						yj[i] = yprev[i] - xprev[i] + xnext[i];
+				}
 			}
-			else
+			for ( index_t j = 0; j < nc; j++ )
 			{
-				// fast O(n) sliding sum
-				double xprev = x[prev * nr + i];
-				double xnext = x[next * nr + i];
-				y[j * nr + i] = y[(j - 1) * nr + i] - xprev + xnext;
+				double * yj = y + j * nr;
+				for ( index_t i = i0; i < i1; i++ )
+					yj[i] /= width;
 			}
+			return;
 		}
-		// calculate means
-		for ( index_t j = 0; j < nc; j++ )
+		for ( index_t i = i0; i < i1; i++ )
 		{
-			if ( !isNA(y[j * nr + i]) )
-				y[j * nr + i] /= width;
-		}
-	}
-	// vertical filter pass
-	for ( index_t j = 0; j < nc; j++ )
-	{
-		for ( index_t i = 0; i < nr; i++ )
-		{
-			prev = norm_ind(i - r - 1, nr);
-			next = norm_ind(i + r, nr);
-			if ( isNA(y[j * nr + i]) )
+			for ( index_t j = 0; j < nc; j++ )
+			{
+				prev = norm_ind(j - r - 1, nc);
+				next = norm_ind(j + r, nc);
+				if ( isNA(x[j * nr + i]) )
+				{
+					// handle missing pixel
+					y[j * nr + i] = NA_REAL;
+				}
+				else if ( j == 0 || isNA(y[(j - 1) * nr + i]) ||
+					isNA(x[prev * nr + i]) || isNA(x[next * nr + i]) )
+				{
+					// handle missing neighborhood
+					double xs = 0;
+					size_t len = 0;
+					for ( index_t k = -r; k <= r; k++ )
+					{
+						jj = norm_ind(j + k, nc);
+						if ( !isNA(x[jj * nr + i]) )
+						{
+							xs += x[jj * nr + i];
+							len++;
+						}
+					}
+					y[j * nr + i] = width * (xs / len);
+				}
+				else
+				{
+					// fast O(n) sliding sum
+					double xprev = x[prev * nr + i];
+					double xnext = x[next * nr + i];
+					y[j * nr + i] = y[(j - 1) * nr + i] - xprev + xnext;
+				}
+			}
+			// calculate means
+			for ( index_t j = 0; j < nc; j++ )
 			{
-				// handle missing pixel
-				z[j * nr + i] = NA_REAL;
+				if ( !isNA(y[j * nr + i]) )
+					y[j * nr + i] /= width;
 			}
-			else if ( i == 0 || isNA(z[j * nr + i - 1]) ||
-				isNA(y[j * nr + prev]) || isNA(y[j * nr + next]) )
+		}
+	});
+	// vertical filter pass (over bands of columns)
+	run_bands(nthreads, nc, [&](index_t j0, index_t j1) {
+		index_t ii, prev, next;
+		for ( index_t j = j0; j < j1; j++ )
+		{
+			if ( finite )
 			{
-				// handle missing neighborhood
+				double * yj = y + j * nr;
+				double * zj = z + j * nr;
 				double ys = 0;
-				size_t len = 0;
 				for ( index_t k = -r; k <= r; k++ )
+					ys += yj[norm_ind(k, nr)];
+				zj[0] = width * (ys / width);
+				// clamp only at the edges
+				index_t lo = min2(r + 1, nr);
+				index_t hi = max2(nr - r, lo);
+				for ( index_t i = 1; i < lo; i++ )
+					zj[i] = zj[i - 1] - yj[norm_ind(i - r - 1, nr)] + yj[norm_ind(i + r, nr)];
+				for ( index_t i = lo; i < hi; i++ )
+					zj[i] = zj[i - 1] - yj[i - r - 1] + yj[i + r];
+				for ( index_t i = hi; i < nr; i++ )
+					zj[i] = zj[i - 1] - yj[i - r - 1] + yj[nr - 1];
+				for ( index_t i = 0; i < nr; i++ )
+					zj[i] /= width;
+				continue;
+			}
+			for ( index_t i = 0; i < nr; i++ )
+			{
+				prev = norm_ind(i - r - 1, nr);
+				next = norm_ind(i + r, nr);
+				if ( isNA(y[j * nr + i]) )
 				{
-					ii = norm_ind(i + k, nr);
-					if ( !isNA(y[j * nr + ii]) )
+					// handle missing pixel
+					z[j * nr + i] = NA_REAL;
+				}
+				else if ( i == 0 || isNA(z[j * nr + i - 1]) ||
+					isNA(y[j * nr + prev]) || isNA(y[j * nr + next]) )
+				{
+					// handle missing neighborhood
+					double ys = 0;
+					size_t len = 0;
+					for ( index_t k = -r; k <= r; k++ )
 					{
-						ys += y[j * nr + ii];
-						len++;
+						ii = norm_ind(i + k, nr);
+						if ( !isNA(y[j * nr + ii]) )
+						{
+							ys += y[j * nr + ii];
+							len++;
+						}
 					}
+					z[j * nr + i] = width * (ys / len);
+				}
+				else
+				{
+					// fast O(n) sliding sum
+					double yprev = y[j * nr + prev];
+					double ynext = y[j * nr + next];
+					z[j * nr + i] = z[j * nr + i - 1] - yprev + ynext;
 				}
-				z[j * nr + i] = width * (ys / len);
 			}
-			else
+			// calculate means
+			for ( index_t i = 0; i < nr; i++ )
 			{
-				// fast O(n) sliding sum
-				double yprev = y[j * nr + prev];
-				double ynext = y[j * nr + next];
-				z[j * nr + i] = z[j * nr + i - 1] - yprev + ynext;
+				if ( !isNA(z[j * nr + i]) )
+					z[j * nr + i] /= width;
 			}
 		}
-		// calculate means
-		for ( index_t i = 0; i < nr; i++ )
-		{
-			if ( !isNA(z[j * nr + i]) )
-				z[j * nr + i] /= width;
-		}
-	}
+	});
 	Free(y);
 }
 
 template<typename T>
 void linear_filter2(T * x, int nr, int nc,
-	double * weights, int width, double * buffer)
+	double * weights, int width, double * buffer, int nthreads = 1)
 {
 	int r = width / 2;
-	index_t ii, jj;
-	for ( index_t i = 0; i < nr; i++ )
+	nthreads = filter2_threads(nthreads, nr, nc);
+	if ( !is_finite2(x, static_cast<size_t>(nr) * nc) )
 	{
-		for ( index_t j = 0; j < nc; j++ )
-		{
-			if ( isNA(x[j * nr + i]) )
+		// handle missing pixels and neighborhoods
+		run_bands(nthreads, nc, [&](index_t j0, index_t j1) {
+			index_t ii, jj;
+			for ( index_t j = j0; j < j1; j++ )
 			{
-				buffer[j * nr + i] = NA_REAL;
-				continue;
+				for ( index_t i = 0; i < nr; i++ )
+				{
+					if ( isNA(x[j * nr + i]) )
+					{
+						buffer[j * nr + i] = NA_REAL;
+						continue;
+					}
+					double xij, wij, W = 0;
+					buffer[j * nr + i] = 0;
+					for (index_t ki = -r; ki <= r; ki++ )
+					{
+						for (index_t kj = -r; kj <= r; kj++ )
+						{
+							ii = norm_ind(i + ki, nr);
+							jj = norm_ind(j + kj, nc);
+							if ( isNA(x[jj * nr + ii]) )
+								continue;
+							xij = x[jj * nr + ii];
+							wij = weights[(kj + r) * width + (ki + r)];
+							buffer[j * nr + i] += wij * xij;
+							W += wij;
+						}
+					}
+					buffer[j * nr + i] /= W;
+				}
 			}
-			double xij, wij, W = 0;
-			buffer[j * nr + i] = 0;
-			for (index_t ki = -r; ki <= r; ki++ )
+		});
+		return;
+	}
+	double W = 0;
+	for ( index_t ki = -r; ki <= r; ki++ )
+		for ( index_t kj = -r; kj <= r; kj++ )
+			W += weights[(kj + r) * width + (ki + r)];
+	double * u = R_Calloc(2 * width, double);
+	double * v = u + width;
+	if ( separate_weights(weights, width, u, v) )
+	{
+		// separable kernel: filter the rows and then the columns
+		double * tmp = R_Calloc(nr * nc, double);
+		run_bands(nthreads, nc, [&](index_t j0, index_t j1) {
+			for ( index_t j = j0; j < j1; j++ )
 			{
-				for (index_t kj = -r; kj <= r; kj++ )
+				double * tj = tmp + j * nr;
+				for ( index_t kj = -r; kj <= r; kj++ )
 				{
-					ii = norm_ind(i + ki, nr);
-					jj = norm_ind(j + kj, nc);
-					if ( isNA(x[jj * nr + ii]) )
-						continue;
-					xij = x[jj * nr + ii];
-					wij = weights[(kj + r) * width + (ki + r)];
-					buffer[j * nr + i] += wij * xij;
-					W += wij;
+					T * xj = x + norm_ind(j + kj, nc) * nr;
+					double w = v[kj + r];
+					for ( index_t i = 0; i < nr; i++ )
+						tj[i] += w * xj[i];
 				}
 			}
-			buffer[j * nr + i] /= W;
-		}
+		});
+		run_bands(nthreads, nc, [&](index_t j0, index_t j1) {
+			for ( index_t j = j0; j < j1; j++ )
+			{
+				double * tj = tmp + j * nr;
+				double * bj = buffer + j * nr;
+				for ( index_t i = 0; i < nr; i++ )
+					bj[i] = 0;
+				for ( index_t ki = -r; ki <= r; ki++ )
+					shift_add(tj, nr, ki, u[ki + r], bj);
+				for ( index_t i = 0; i < nr; i++ )
+					bj[i] /= W;
+			}
+		});
+		Free(tmp);
+	}
+	else
+	{
+		// accumulate whole shifted columns
+		run_bands(nthreads, nc, [&](index_t j0, index_t j1) {
+			for ( index_t j = j0; j < j1; j++ )
+			{
+				double * bj = buffer + j * nr;
+				for ( index_t i = 0; i < nr; i++ )
+					bj[i] = 0;
+				for ( index_t kj = -r; kj <= r; kj++ )
+				{
+					T * xj = x + norm_ind(j + kj, nc) * nr;
+					for ( index_t ki = -r; ki <= r; ki++ )
+						shift_add(xj, nr, ki, weights[(kj + r) * width + (ki + r)], bj);
+				}
+				for ( index_t i = 0; i < nr; i++ )
+					bj[i] /= W;
+			}
+		});
 	}
+	Free(u);
 }
 
 template<typename T>
 void bilateral_filter2(T * x, int nr, int nc, int width,
-	double sddist, double sdrange, double spar, double * buffer)
+	double sddist, double sdrange, double spar,
+	double * buffer, int nthreads = 1)
 {
 	int r = width / 2;
 	size_t n = nr * nc;
-	index_t ii, jj;
-	double sdd = sddist, sdr = sdrange;
 	double xmedian, xmad, xrange;
 	double D = std::sqrt(r * r + r * r);
-	if ( !isNA(spar) )
+	bool adaptive = !isNA(spar);
+	double * dxs = NULL;
+	if ( adaptive )
 	{
 		// get MAD if using adaptive parameters
 		xmedian = quick_median(x, n);
@@ -298,139 +502,169 @@ void bilateral_filter2(T * x, int nr, int nc, int width,
 		double xmin = do_min(x, 0, n - 1);
 		double xmax = do_max(x, 0, n - 1);
 		xrange = xmax - xmin;
+		// find mean of local differences (in O(n) time)
+		double * dev = R_Calloc(n, double);
+		dxs = R_Calloc(n, double);
+		for ( size_t i = 0; i < n; i++ )
+			dev[i] = isNA(x[i]) ? 0 : std::fabs(x[i] - xmedian);
+		mean_filter2(dev, nr, nc, width, dxs, nthreads);
+		Free(dev);
 	}
-	for ( index_t i = 0; i < nr; i++ )
+	// precompute the spatial weights if they're not adaptive
+	bool adaptdist = adaptive && isNA(sddist);
+	double * wtdist = R_Calloc(width * width, double);
+	if ( !adaptdist )
 	{
-		for ( index_t j = 0; j < nc; j++ )
+		for ( index_t ki = -r; ki <= r; ki++ )
+			for ( index_t kj = -r; kj <= r; kj++ )
+				wtdist[(kj + r) * width + (ki + r)] =
+					kgaussian(ki, sddist) * kgaussian(kj, sddist);
+	}
+	nthreads = filter2_threads(nthreads, nr, nc);
+	run_bands(nthreads, nc, [&](index_t j0, index_t j1) {
+		index_t ii, jj;
+		double sdd = sddist, sdr = sdrange;
+		std::vector<double> wt1(r + 1);
+		for ( index_t j = j0; j < j1; j++ )
 		{
-			if ( isNA(x[j * nr + i]) )
-			{
-				buffer[j * nr + i] = NA_REAL;
-				continue;
-			}
-			double xij, dx = 0, W = 0;
-			buffer[j * nr + i] = 0;
-			if ( !isNA(spar) )
+			bool jborder = j < r || j >= nc - r;
+			for ( index_t i = 0; i < nr; i++ )
 			{
-				// modified version of Joseph & Periyasamy (2018)
+				bool border = jborder || i < r || i >= nr - r;
+				if ( isNA(x[j * nr + i]) )
+				{
+					buffer[j * nr + i] = NA_REAL;
+					continue;
+				}
+				double xij, W = 0;
+				buffer[j * nr + i] = 0;
+				if ( adaptive )
+				{
+					// modified version of Joseph & Periyasamy (2018)
+					double dx = dxs[j * nr + i];
+					// calculate adaptive parameters
+					double z = std::fabs(dx - xmad) / spar;
+					if ( isNA(sddist) ) {
+						sdd = D * std::exp(-z) / std::sqrt(2);
+						kgaussian_lut(r, sdd, wt1.data());
+					}
+					if ( isNA(sdrange) )
+						sdr = xrange * std::exp(-z) / std::sqrt(2);
+				}
+				if ( sdd <= DBL_EPSILON || sdr <= DBL_EPSILON )
+				{
+					// avoid singularities
+					buffer[j * nr + i] = x[j * nr + i];
+					continue;
+				}
 				for ( index_t ki = -r; ki <= r; ki++ )
 				{
 					for ( index_t kj = -r; kj <= r; kj++ )
 					{
-						// find mean of local differences
-						ii = norm_ind(i + ki, nr);
-						jj = norm_ind(j + kj, nc);
-						if ( !isNA(x[jj * nr + ii]) )
-						{
-							xij = x[jj * nr + ii];
-							dx += std::fabs(xij - xmedian);
-						}
+						// standard bilateral filter
+						ii = border ? norm_ind(i + ki, nr) : i + ki;
+						jj = border ? norm_ind(j + kj, nc) : j + kj;
+						if ( isNA(x[jj * nr + ii]) )
+							continue;
+						xij = x[jj * nr + ii];
+						double wtd = adaptdist ?
+							wt1[ki < 0 ? -ki : ki] * wt1[kj < 0 ? -kj : kj] :
+							wtdist[(kj + r) * width + (ki + r)];
+						double wtrange = kgaussian(xij - x[j * nr + i], sdr);
+						buffer[j * nr + i] += wtd * wtrange * xij;
+						W += wtd * wtrange;
 					}
 				}
-				dx /= (width * width);
-				// calculate adaptive parameters
-				double z = std::fabs(dx - xmad) / spar;
-				if ( isNA(sddist) )
-					sdd = D * std::exp(-z) / std::sqrt(2);
-				if ( isNA(sdrange) )
-					sdr = xrange * std::exp(-z) / std::sqrt(2);
-			}
-			if ( sdd <= DBL_EPSILON || sdr <= DBL_EPSILON )
-			{
-				// avoid singularities
-				buffer[j * nr + i] = x[j * nr + i];
-				continue;
-			}
-			for ( index_t ki = -r; ki <= r; ki++ )
-			{
-				for ( index_t kj = -r; kj <= r; kj++ )
-				{
-					// standard bilateral filter
-					ii = norm_ind(i + ki, nr);
-					jj = norm_ind(j + kj, nc);
-					if ( isNA(x[jj * nr + ii]) )
-						continue;
-					xij = x[jj * nr + ii];
-					double wtdist = kgaussian(ki, sdd) * kgaussian(kj, sdd);
-					double wtrange = kgaussian(xij - x[j * nr + i], sdr);
-					buffer[j * nr + i] += wtdist * wtrange * xij;
-					W += wtdist * wtrange;
-				}
+				if ( !isNA(buffer[j * nr + i]) )
+					buffer[j * nr + i] /= W;
 			}
-			if ( !isNA(buffer[j * nr + i]) )
-				buffer[j * nr + i] /= W;
 		}
-	}
+	});
+	Free(wtdist);
+	if ( adaptive )
+		Free(dxs);
+}
+
+// piecewise-linear approximation of the bilateral filter
+// (see bilateral_approx) with O(1) cost per pixel
+template<typename T>
+void bilateral_filter2_fast(T * x, int nr, int nc, double sddist,
+	double sdrange, int nlevels, double * buffer, int nthreads = 1)
+{
+	bilateral_approx(x, static_cast<size_t>(nr) * nc, sddist, sdrange, nlevels, buffer,
+		[&](double * y, int width, double * z) {
+			mean_filter2(y, nr, nc, width, z, nthreads);
+		});
 }
 
 template<typename T>
 void diffusion_filter2(T * x, int nr, int nc, int niter,
-	double K, double rate, int method, double * buffer)
+	double K, double rate, int method,
+	double * buffer, int nthreads = 1)
 {
 	size_t n = nr * nc;
-	index_t N, S, E, W;
-	double dN, dS, dE, dW, cN, cS, cE, cW, dx;
+	if ( method != DIFF_EQ1 && method != DIFF_EQ2 )
+		Rf_error("unrecognized diffusivity");
 	double * tmp = R_Calloc(n, double);
 	double * x0 = tmp;
 	double * x1 = buffer;
 	// initialize buffer
-	for ( index_t i = 0; i < n; i++ )
+	for ( size_t i = 0; i < n; i++ )
 		buffer[i] = coerce_cast<double>(x[i]);
+	nthreads = filter2_threads(nthreads, nr, nc);
 	// iterate
 	for ( int iter = 0; iter < niter; iter++ )
 	{
 		std::memcpy(x0, x1, n * sizeof(double));
-		for ( index_t i = 0; i < nr; i++ )
-		{
-			for ( index_t j = 0; j < nc; j++ )
+		run_bands(nthreads, nc, [&](index_t j0, index_t j1) {
+			index_t N, S, E, W;
+			double dN, dS, dE, dW, cN, cS, cE, cW, dx;
+			for ( index_t j = j0; j < j1; j++ )
 			{
-				if ( isNA(x0[j * nr + i]) )
-				{
-					x1[j * nr + i] = NA_REAL;
-					continue;
-				}
-				// calculate gradients
-				N = norm_ind(i - 1, nr);
-				S = norm_ind(i + 1, nr);
 				E = norm_ind(j + 1, nc);
 				W = norm_ind(j - 1, nc);
-				dN = isNA(x0[j * nr + N]) ? 0 : sdiff(x0[j * nr + N], x0[j * nr + i]);
-				dS = isNA(x0[j * nr + S]) ? 0 : sdiff(x0[j * nr + S], x0[j * nr + i]);
-				dE = isNA(x0[E * nr + i]) ? 0 : sdiff(x0[E * nr + i], x0[j * nr + i]);
-				dW = isNA(x0[W * nr + i]) ? 0 : sdiff(x0[W * nr + i], x0[j * nr + i]);
-				// calculate conduction
-				switch(method) {
-					case DIFF_EQ1:
+				for ( index_t i = 0; i < nr; i++ )
+				{
+					if ( isNA(x0[j * nr + i]) )
+					{
+						x1[j * nr + i] = NA_REAL;
+						continue;
+					}
+					// calculate gradients
+					N = norm_ind(i - 1, nr);
+					S = norm_ind(i + 1, nr);
+					dN = isNA(x0[j * nr + N]) ? 0 : sdiff(x0[j * nr + N], x0[j * nr + i]);
+					dS = isNA(x0[j * nr + S]) ? 0 : sdiff(x0[j * nr + S], x0[j * nr + i]);
+					dE = isNA(x0[E * nr + i]) ? 0 : sdiff(x0[E * nr + i], x0[j * nr + i]);
+					dW = isNA(x0[W * nr + i]) ? 0 : sdiff(x0[W * nr + i], x0[j * nr + i]);
+					// calculate conduction
+					if ( method == DIFF_EQ1 )
 					{
 						cN = std::exp(-(dN / K) * (dN / K));
 						cS = std::exp(-(dS / K) * (dS / K));
 						cE = std::exp(-(dE / K) * (dE / K));
 						cW = std::exp(-(dW / K) * (dN / K));
-						break;
 					}
-					case DIFF_EQ2:
+					else
 					{
 						cN = 1 / (1 + (dN / K) * (dN / K));
 						cS = 1 / (1 + (dS / K) * (dS / K));
 						cE = 1 / (1 + (dE / K) * (dE / K));
 						cW = 1 / (1 + (dW / K) * (dN / K));
-						break;
 					}
-					default:
-						Rf_error("unrecognized diffusivity");
+					// update image
+					dx = (cN * dN) + (cS * dS) + (cE * dE) + (cW * dW);
+					x1[j * nr + i] = x0[j * nr + i] + rate * dx;
 				}
-				// update image
-				dx = (cN * dN) + (cS * dS) + (cE * dE) + (cW * dW);
-				x1[j * nr + i] = x0[j * nr + i] + rate * dx;
 			}
-		}
+		});
 	}
 	Free(tmp);
 }
 
 template<typename T>
 void guided_filter2(T * x, T * g, int nr, int nc, int width,
-	double sdreg, double * buffer)
+	double sdreg, double * buffer, int nthreads = 1)
 {
 	size_t n = nr * nc;
 	// allocate buffers for mean filter results
@@ -444,8 +678,8 @@ void guided_filter2(T * x, T * g, int nr, int nc, int width,
 	double * ptr3 = tmp + 2 * n;
 	double * ptr4 = tmp + 3 * n;
 	// calculate means
-	mean_filter2(g, nr, nc, width, ug);
-	mean_filter2(x, nr, nc, width, ux);
+	mean_filter2(g, nr, nc, width, ug, nthreads);
+	mean_filter2(x, nr, nc, width, ux, nthreads);
 	// calculate variances and covariances
 	double * gg = ptr1;
 	double * gx = ptr2;
@@ -464,8 +698,8 @@ void guided_filter2(T * x, T * g, int nr, int nc, int width,
 	}
 	double * sg = ptr3;
 	double * sgx = ptr4;
-	mean_filter2(gg, nr, nc, width, sg);
-	mean_filter2(gx, nr, nc, width, sgx);
+	mean_filter2(gg, nr, nc, width, sg, nthreads);
+	mean_filter2(gx, nr, nc, width, sgx, nthreads);
 	for ( size_t i = 0; i < n; i++ )
 	{
 		if ( isNA(g[i]) || isNA(x[i]) )
@@ -498,8 +732,8 @@ void guided_filter2(T * x, T * g, int nr, int nc, int width,
 	}
 	double * ua = ptr3;
 	double * ub = ptr4;
-	mean_filter2(a, nr, nc, width, ua);
-	mean_filter2(b, nr, nc, width, ub);
+	mean_filter2(a, nr, nc, width, ua, nthreads);
+	mean_filter2(b, nr, nc, width, ub, nthreads);
 	// calculate output signal
 	for ( size_t i = 0; i < n; i++ )
 		buffer[i] = ua[i] * g[i] + ub[i];
@@ -3,6 +3,7 @@
 
 #include "matter.h"
 #include "signal.h"
+#include "dist.h"
 
 class Sparse : public ArrayInterface {
 
@@ -133,6 +134,57 @@ class Sparse : public ArrayInterface {
 };
 
 
+//// Batch of compressed vectors
+//--------------------------------
+
+#define SPARSE_SLABSIZE 1048576
+
+// typed index/data of several compressed (CSC/CSR) vectors
+// stored back-to-back in reusable buffers
+template<typename Tind, typename Tval>
+struct SparseSlab {
+	std::vector<index_t> at;		// which compressed vectors
+	std::vector<index_t> from;		// where each starts in the source
+	std::vector<index_t> start;		// where each starts in the slab
+	std::vector<Tind> index;
+	std::vector<Tval> data;
+
+	void clear() {
+		at.clear();
+		from.clear();
+		start.assign(1, 0);
+	}
+
+	size_t size() {
+		return at.size();
+	}
+
+	size_t nnz() {
+		return static_cast<size_t>(start.back());
+	}
+
+	size_t nnz(index_t k) {
+		return static_cast<size_t>(start[k + 1] - start[k]);
+	}
+
+	Tind * index_ptr(index_t k) {
+		return index.data() + start[k];
+	}
+
+	Tval * data_ptr(index_t k) {
+		return data.data() + start[k];
+	}
+};
+
+// requested subscripts sorted once for exact-match merge joins
+template<typename Tind>
+struct SparseKeys {
+	std::vector<Tind> keys;			// sorted (non-NA) keys
+	std::vector<index_t> pos;		// output position of each key
+	std::vector<index_t> na;		// output positions of NAs
+	index_t size;					// number of subscripts
+};
+
 class SparseArray : public Sparse {
 
 	public:
@@ -201,6 +253,19 @@ class SparseArray : public Sparse {
 			}
 		}
 
+		template<typename T>
+		T domain_elt(index_t i)
+		{
+			switch(TYPEOF(domain())) {
+				case INTSXP:
+					return INTEGER_ELT(domain(), i);
+				case REALSXP:
+					return REAL_ELT(domain(), i);
+				default:
+					return i + offset();
+			}
+		}
+
 		template<typename T>
 		void copy_domain(SEXP indx, T * buffer, bool ind1 = true)
 		{
@@ -296,45 +361,274 @@ class SparseArray : public Sparse {
 			return ans;
 		}
 
+		// number of nonzeros in a compressed vector
+		// (and where it starts in the index/data)
+		index_t compressed_length(index_t at, index_t * from)
+		{
+			*from = 0;
+			if ( isNA(at) )
+				return 0;
+			if ( at < 0 || at >= dense_extent() )
+				Rf_error("subscript out of bounds");
+			if ( has_pointers() )
+			{
+				Pair<index_t,index_t> p = pointers(at);
+				*from = p.first;
+				return p.second - p.first;
+			}
+			else if ( Rf_isS4(_index) )
+				return IndexElt(R_do_slot(_index, Rf_install("dim")), at);
+			else
+				return XLENGTH(VECTOR_ELT(_index, at));
+		}
+
 		template<typename Tind, typename Tval>
-		size_t get_compressed_region(index_t at,
+		void push_slab(SparseSlab<Tind,Tval> & slab, index_t at)
+		{
+			index_t from;
+			index_t len = compressed_length(at, &from);
+			slab.at.push_back(at);
+			slab.from.push_back(from);
+			slab.start.push_back(slab.start.back() + len);
+		}
+
+		// read the index and data of all queued vectors
+		template<typename Tind, typename Tval>
+		void read_slab(SparseSlab<Tind,Tval> & slab)
+		{
+			slab.index.resize(slab.nnz());
+			slab.data.resize(slab.nnz());
+			read_compressed<Tind>(_index, slab, slab.index.data());
+			read_compressed<Tval>(_data, slab, slab.data.data());
+		}
+
+		// read compressed vectors at(0), ..., at(n - 1) in slabs
+		// and call f(k, slab, s) with each (s is its slab position)
+		template<typename Tind, typename Tval, typename Fat, typename F>
+		void read_slabs(index_t n, Fat at, F f)
+		{
+			SparseSlab<Tind,Tval> slab;
+			index_t k0 = 0;
+			while ( k0 < n )
+			{
+				slab.clear();
+				index_t k1 = k0;
+				while ( k1 < n && (k1 == k0 || slab.nnz() < SPARSE_SLABSIZE) )
+					push_slab(slab, at(k1++));
+				read_slab(slab);
+				for ( index_t k = k0; k < k1; k++ )
+					f(k, slab, k - k0);
+				k0 = k1;
+			}
+		}
+
+		template<typename T>
+		void copy_compressed(SEXP x, index_t i, size_t size, T * buffer)
+		{
+			switch(TYPEOF(x)) {
+				case INTSXP:
+				case LGLSXP: {
+					int * px = DataPtr<int>(x) + i;
+					for ( size_t k = 0; k < size; k++ )
+						buffer[k] = coerce_cast<T>(px[k]);
+					break;
+				}
+				case REALSXP: {
+					double * px = DataPtr<double>(x) + i;
+					for ( size_t k = 0; k < size; k++ )
+						buffer[k] = coerce_cast<T>(px[k]);
+					break;
+				}
+				default:
+					Rf_error("unsupported data type");
+			}
+		}
+
+		// out-of-memory reads are queued together so they
+		// are done in file order with nearby reads merged
+		template<typename T, typename Tind, typename Tval>
+		void read_compressed(SEXP x, SparseSlab<Tind,Tval> & slab, T * buffer)
+		{
+			index_t n = slab.size();
+			if ( Rf_isS4(x) && has_list_storage() )
+			{
+				MatterList xl(x);
+				Atoms * atoms = xl.data();
+				bool batch = atoms->begin_reads(n > 1);
+				for ( index_t k = 0; k < n; k++ )
+					if ( slab.nnz(k) > 0 )
+						atoms->get_region<T>(buffer + slab.start[k],
+							0, slab.nnz(k), slab.at[k]);
+				if ( batch )
+					atoms->end_reads();
+			}
+			else if ( Rf_isS4(x) )
+			{
+				MatterArray xa(x);
+				if ( xa.is_transposed() || xa.has_ops() )
+				{
+					for ( index_t k = 0; k < n; k++ )
+						if ( slab.nnz(k) > 0 )
+							xa.get_region<T>(slab.from[k], slab.nnz(k),
+								buffer + slab.start[k]);
+				}
+				else
+				{
+					Atoms * atoms = xa.data()->flatten();
+					bool batch = atoms->begin_reads(n > 1);
+					for ( index_t k = 0; k < n; k++ )
+						if ( slab.nnz(k) > 0 )
+							atoms->get_region<T>(buffer + slab.start[k],
+								slab.from[k], slab.nnz(k));
+					if ( batch )
+						atoms->end_reads();
+					atoms->flatten(false);
+				}
+			}
+			else
+			{
+				for ( index_t k = 0; k < n; k++ )
+				{
+					if ( slab.nnz(k) == 0 )
+						continue;
+					SEXP xk = has_list_storage() ? VECTOR_ELT(x, slab.at[k]) : x;
+					copy_compressed<T>(xk, slab.from[k], slab.nnz(k),
+						buffer + slab.start[k]);
+				}
+			}
+		}
+
+		// with zero tolerance the subscripts can be matched exactly
+		bool exact_match() {
+			return tol() == 0;
+		}
+
+		template<typename Tind>
+		void make_keys(SEXP indx, SparseKeys<Tind> & keys)
+		{
+			index_t len = XLENGTH(indx);
+			std::vector<Tind> subscripts(len);
+			std::vector<index_t> order;
+			order.reserve(len);
+			keys.na.clear();
+			keys.size = len;
+			copy_domain<Tind>(indx, subscripts.data());
+			for ( index_t k = 0; k < len; k++ )
+			{
+				if ( isNA(subscripts[k]) )
+					keys.na.push_back(k);
+				else
+					order.push_back(k);
+			}
+			std::stable_sort(order.begin(), order.end(),
+				[&](index_t a, index_t b) { return subscripts[a] < subscripts[b]; });
+			keys.keys.resize(order.size());
+			keys.pos.resize(order.size());
+			for ( size_t k = 0; k < order.size(); k++ )
+			{
+				keys.keys[k] = subscripts[order[k]];
+				keys.pos[k] = order[k];
+			}
+		}
+
+		// merge join sorted keys against a sorted compressed index
+		template<typename Tind, typename Tval>
+		size_t merge_keys(Tind * pj, Tval * px, size_t n,
+			SparseKeys<Tind> & keys, Tval * buffer, int stride = 1)
+		{
+			size_t nnz = 0;
+			fill<Tval>(buffer, keys.size, zero<Tval>(), stride);
+			for ( size_t k = 0; k < keys.na.size(); k++ )
+				buffer[keys.na[k] * stride] = NA<Tval>();
+			size_t a = 0, b = 0, m = keys.keys.size();
+			while ( a < m && b < n )
+			{
+				if ( keys.keys[a] < pj[b] )
+					a++;
+				else if ( pj[b] < keys.keys[a] )
+					b++;
+				else {
+					buffer[keys.pos[a] * stride] = px[b];
+					nnz++;
+					a++;
+				}
+			}
+			return nnz;
+		}
+
+		template<typename Tind, typename Tval>
+		size_t decode_region(Tind * pj, Tval * px, size_t n,
 			index_t i, size_t size, Tval * buffer, int stride = 1)
 		{
-			if ( at < 0 || at > dense_extent() )
-				Rf_error("subscript out of bounds");
-			if ( i < 0 || i + size > sparse_extent() )
+			if ( i < 0 || i + static_cast<index_t>(size) > sparse_extent() )
 				Rf_error("subscript out of bounds");
-			if ( isNA(at) ) {
-				fill<Tval>(buffer, size, NA<Tval>(), stride);
-				return 0;
-			}
-			SEXP j, x;
-			PROTECT(j = index(at));
-			PROTECT(x = data(at));
 			size_t nnz = 0;
 			if ( has_domain() )
 			{
 				Tind * subscripts = R_Calloc(size, Tind);
 				copy_domain<Tind>(i, size, subscripts);
 				nnz = do_approx1<Tind,Tval>(buffer, subscripts, size,
-					DataPtr<Tind>(j), DataPtr<Tval>(x), 0, XLENGTH(j),
-					tol(), tol_ref(), zero<Tval>(), sampler(), stride);
+					pj, px, 0, n, tol(), tol_ref(), zero<Tval>(),
+					sampler(), stride);
 				Free(subscripts);
 			}
 			else
 			{
 				fill<Tval>(buffer, size, zero<Tval>(), stride);
-				for ( index_t k = 0; k < XLENGTH(x); k++ )
+				for ( size_t k = 0; k < n; k++ )
 				{
-					Tind * pj = DataPtr<Tind>(j);
-					Tval * px = DataPtr<Tval>(x);
-					index_t ii = static_cast<index_t>(pj[k]) - i;
-					if ( ii < 0 || ii >= size )
+					index_t ii = static_cast<index_t>(pj[k]) - offset() - i;
+					if ( ii < 0 || ii >= static_cast<index_t>(size) )
 						continue;
-					buffer[(ii - offset()) * stride] = px[k];
+					buffer[ii * stride] = px[k];
 					nnz++;
 				}
 			}
+			return nnz;
+		}
+
+		template<typename Tind, typename Tval>
+		size_t decode_elements(Tind * pj, Tval * px, size_t n,
+			SEXP indx, Tval * buffer, int stride = 1,
+			SparseKeys<Tind> * keys = NULL)
+		{
+			if ( Rf_isNull(indx) )
+				return decode_region<Tind,Tval>(pj, px, n,
+					0, sparse_extent(), buffer, stride);
+			if ( exact_match() && is_sorted(pj, n) )
+			{
+				if ( keys != NULL )
+					return merge_keys<Tind,Tval>(pj, px, n, *keys, buffer, stride);
+				SparseKeys<Tind> k;
+				make_keys<Tind>(indx, k);
+				return merge_keys<Tind,Tval>(pj, px, n, k, buffer, stride);
+			}
+			Tind * subscripts = R_Calloc(XLENGTH(indx), Tind);
+			copy_domain<Tind>(indx, subscripts);
+			size_t nnz = do_approx1<Tind,Tval>(buffer, subscripts,
+				XLENGTH(indx), pj, px, 0, n, tol(), tol_ref(), zero<Tval>(),
+				sampler(), stride);
+			Free(subscripts);
+			return nnz;
+		}
+
+		template<typename Tind, typename Tval>
+		size_t get_compressed_region(index_t at,
+			index_t i, size_t size, Tval * buffer, int stride = 1)
+		{
+			if ( at < 0 || at > dense_extent() )
+				Rf_error("subscript out of bounds");
+			if ( i < 0 || i + static_cast<index_t>(size) > sparse_extent() )
+				Rf_error("subscript out of bounds");
+			if ( isNA(at) ) {
+				fill<Tval>(buffer, size, NA<Tval>(), stride);
+				return 0;
+			}
+			SEXP j, x;
+			PROTECT(j = index(at));
+			PROTECT(x = data(at));
+			size_t nnz = decode_region<Tind,Tval>(DataPtr<Tind>(j),
+				DataPtr<Tval>(x), XLENGTH(j), i, size, buffer, stride);
 			UNPROTECT(2);
 			return nnz;
 		}
@@ -355,16 +649,110 @@ class SparseArray : public Sparse {
 			SEXP j, x;
 			PROTECT(j = index(at));
 			PROTECT(x = data(at));
-			Tind * subscripts = R_Calloc(XLENGTH(indx), Tind);
-			copy_domain<Tind>(indx, subscripts);
-			size_t nnz = do_approx1<Tind,Tval>(buffer, subscripts,
-				XLENGTH(indx), DataPtr<Tind>(j), DataPtr<Tval>(x), 0, XLENGTH(j),
-				tol(), tol_ref(), zero<Tval>(), sampler(), stride);
-			Free(subscripts);
+			size_t nnz = decode_elements<Tind,Tval>(DataPtr<Tind>(j),
+				DataPtr<Tval>(x), XLENGTH(j), indx, buffer, stride);
 			UNPROTECT(2);
 			return nnz;
 		}
 
+		// linear (column-major) indexing of a sparse matrix:
+		// each touched compressed vector is decoded only once
+
+		template<typename Tind, typename Tval>
+		size_t get_linear_region(index_t i, size_t size, Tval * buffer, int stride = 1)
+		{
+			size_t nnz = 0;
+			if ( size == 0 )
+				return nnz;
+			if ( i < 0 || i + static_cast<index_t>(size) > length() )
+				Rf_error("subscript out of bounds");
+			index_t nr = dim(0);
+			index_t last = i + size - 1;
+			if ( is_transposed() )
+			{
+				// each row spans a strided range of columns
+				index_t nrows = static_cast<index_t>(size) < nr ? size : nr;
+				read_slabs<Tind,Tval>(nrows,
+					[&](index_t k) { return (i + k) % nr; },
+					[&](index_t k, SparseSlab<Tind,Tval> & slab, index_t s) {
+						index_t row = slab.at[s];
+						index_t c0 = (i + k) / nr;
+						index_t c1 = (last - row) / nr;
+						nnz += decode_region<Tind,Tval>(slab.index_ptr(s),
+							slab.data_ptr(s), slab.nnz(s), c0, c1 - c0 + 1,
+							buffer + k * stride, nr * stride);
+					});
+			}
+			else
+			{
+				// each column spans a contiguous range of rows
+				index_t col0 = i / nr;
+				read_slabs<Tind,Tval>(last / nr - col0 + 1,
+					[&](index_t k) { return col0 + k; },
+					[&](index_t k, SparseSlab<Tind,Tval> & slab, index_t s) {
+						index_t col = slab.at[s];
+						index_t r0 = k == 0 ? i % nr : 0;
+						index_t r1 = col == last / nr ? last % nr : nr - 1;
+						index_t pos = col * nr + r0 - i;
+						nnz += decode_region<Tind,Tval>(slab.index_ptr(s),
+							slab.data_ptr(s), slab.nnz(s), r0, r1 - r0 + 1,
+							buffer + pos * stride, stride);
+					});
+			}
+			return nnz;
+		}
+
+		template<typename Tind, typename Tval>
+		size_t get_linear_elements(SEXP indx, Tval * buffer, int stride = 1)
+		{
+			size_t nnz = 0;
+			index_t len = XLENGTH(indx), nr = dim(0);
+			// map to (dense, sparse) coordinates
+			std::vector<index_t> dense(len), sparse(len), order;
+			order.reserve(len);
+			for ( index_t k = 0; k < len; k++ )
+			{
+				index_t ik = IndexElt(indx, k);
+				if ( isNA(ik) ) {
+					buffer[k * stride] = NA<Tval>();
+					continue;
+				}
+				ik--;
+				if ( ik < 0 || ik >= length() )
+					Rf_error("subscript out of bounds");
+				index_t row = ik % nr, col = ik / nr;
+				dense[k] = is_transposed() ? row : col;
+				sparse[k] = is_transposed() ? col : row;
+				order.push_back(k);
+			}
+			// group by compressed vector
+			std::stable_sort(order.begin(), order.end(),
+				[&](index_t a, index_t b) { return dense[a] < dense[b]; });
+			std::vector<index_t> groups;
+			for ( size_t k = 0; k < order.size(); k++ )
+				if ( k == 0 || dense[order[k]] != dense[order[k - 1]] )
+					groups.push_back(k);
+			index_t ngroups = groups.size();
+			groups.push_back(order.size());
+			std::vector<Tind> subscripts;
+			std::vector<Tval> tmp;
+			read_slabs<Tind,Tval>(ngroups,
+				[&](index_t g) { return dense[order[groups[g]]]; },
+				[&](index_t g, SparseSlab<Tind,Tval> & slab, index_t s) {
+					index_t n = groups[g + 1] - groups[g];
+					subscripts.resize(n);
+					tmp.resize(n);
+					for ( index_t q = 0; q < n; q++ )
+						subscripts[q] = domain_elt<Tind>(sparse[order[groups[g] + q]]);
+					nnz += do_approx1<Tind,Tval>(tmp.data(), subscripts.data(), n,
+						slab.index_ptr(s), slab.data_ptr(s), 0, slab.nnz(s),
+						tol(), tol_ref(), zero<Tval>(), sampler(), 1);
+					for ( index_t q = 0; q < n; q++ )
+						buffer[order[groups[g] + q] * stride] = tmp[q];
+				});
+			return nnz;
+		}
+
 		template<typename Tind, typename Tval>
 		size_t get_region(index_t i, size_t size, Tval * buffer, int stride = 1)
 		{
@@ -372,7 +760,7 @@ class SparseArray : public Sparse {
 			if ( rank() == 1 )
 				nnz = get_compressed_region<Tind,Tval>(0, i, size, buffer, stride);
 			else
-				Rf_error("linear indexing for sparse arrays is not supported yet");
+				nnz = get_linear_region<Tind,Tval>(i, size, buffer, stride);
 			if ( has_ops() )
 				ops()->apply<Tval>(buffer, i, size, stride);
 			return nnz;
@@ -384,8 +772,10 @@ class SparseArray : public Sparse {
 			size_t nnz;
 			if ( rank() == 1 )
 				nnz = get_compressed_elements<Tind,Tval>(0, indx, buffer, stride);
+			else if ( Rf_isNull(indx) )
+				nnz = get_linear_region<Tind,Tval>(0, length(), buffer, stride);
 			else
-				Rf_error("linear indexing for sparse arrays is not supported yet");
+				nnz = get_linear_elements<Tind,Tval>(indx, buffer, stride);
 			if ( has_ops() )
 				ops()->apply<Tval>(buffer, indx, stride);
 			return nnz;
@@ -394,8 +784,6 @@ class SparseArray : public Sparse {
 		SEXP get_region(index_t i, size_t size)
 		{
 			SEXP x;
-			if ( rank() != 1 )
-				Rf_error("linear indexing for sparse arrays is not supported yet");
 			PROTECT(x = Rf_allocVector(datatype(), size));
 			switch(datatype()) {
 				case INTSXP:
@@ -433,8 +821,6 @@ class SparseArray : public Sparse {
 		SEXP get_elements(SEXP indx)
 		{
 			SEXP x;
-			if ( rank() != 1 )
-				Rf_error("linear indexing for sparse arrays is not supported yet");
 			if ( Rf_isNull(indx) )
 				return get_region(0, length());
 			PROTECT(x = Rf_allocVector(datatype(), XLENGTH(indx)));
@@ -494,40 +880,33 @@ class SparseMatrix : public SparseArray
 			int nc = Rf_isNull(j) ? ncol() : LENGTH(j);
 			int s1 = is_transposed() ? (nr * stride) : stride;
 			int s2 = is_transposed() ? stride : (nr * stride);
-			if ( is_transposed() )
-			{
-				for ( index_t k = 0; k < nr; k++ )
-				{
-					index_t row = k;
-					if ( !Rf_isNull(i) ) {
-						row = IndexElt(i, k);
-						row = isNA(row) ? row : row - 1;
+			// compressed vectors are read in slabs of columns
+			// (or rows if transposed) then decoded from the slab
+			SEXP dense = is_transposed() ? i : j;
+			SEXP sparse = is_transposed() ? j : i;
+			index_t ndense = is_transposed() ? nr : nc;
+			index_t nsparse = is_transposed() ? nc : nr;
+			// sort the sparse subscripts once for all vectors
+			SparseKeys<Tind> keys;
+			if ( !Rf_isNull(sparse) && exact_match() )
+				make_keys<Tind>(sparse, keys);
+			read_slabs<Tind,Tval>(ndense,
+				[&](index_t k) {
+					index_t at = k;
+					if ( !Rf_isNull(dense) ) {
+						at = IndexElt(dense, k);
+						at = isNA(at) ? at : at - 1;
 					}
-					if ( isNA(row) )
-						nnz += fill<Tval>(buffer + k * s2, nc, NA<Tval>(), s1);
-					else if ( Rf_isNull(j) )
-						nnz += get_compressed_region<Tind,Tval>(row, 0, ncol(), buffer + k * s2, s1);
+					return at;
+				},
+				[&](index_t k, SparseSlab<Tind,Tval> & slab, index_t s) {
+					if ( isNA(slab.at[s]) )
+						nnz += fill<Tval>(buffer + k * s2, nsparse, NA<Tval>(), s1);
 					else
-						nnz += get_compressed_elements<Tind,Tval>(row, j, buffer + k * s2, s1);
-				}
-			}
-			else
-			{
-				for ( index_t k = 0; k < nc; k++ )
-				{
-					index_t col = k;
-					if ( !Rf_isNull(j) ) {
-						col = IndexElt(j, k);
-						col = isNA(col) ? col : col - 1;
-					}
-					if ( isNA(col) )
-						nnz += fill<Tval>(buffer + k * s2, nr, NA<Tval>(), s1);
-					else if ( Rf_isNull(i) )
-						nnz += get_compressed_region<Tind,Tval>(col, 0, nrow(), buffer + k * s2, s1);
-					else
-						nnz += get_compressed_elements<Tind,Tval>(col, i, buffer + k * s2, s1);
-				}
-			}
+						nnz += decode_elements<Tind,Tval>(slab.index_ptr(s),
+							slab.data_ptr(s), slab.nnz(s), sparse, buffer + k * s2, s1,
+							exact_match() ? &keys : NULL);
+				});
 			if ( has_ops() )
 				ops()->apply<Tval>(buffer, i, j, stride);
 			return nnz;
@@ -572,6 +951,217 @@ class SparseMatrix : public SparseArray
 			return x;
 		}
 
+		// nonzeros can be visited directly if subscripts match keys
+		// exactly, there are no deferred ops, and any domain is
+		// strictly increasing (so each key has one position)
+		bool has_exact_nonzeros()
+		{
+			if ( !exact_match() || has_ops() )
+				return false;
+			switch(TYPEOF(domain())) {
+				case NILSXP:
+					return true;
+				case INTSXP:
+					return is_sorted(INTEGER(domain()), LENGTH(domain()), true);
+				case REALSXP:
+					return is_sorted(REAL(domain()), LENGTH(domain()), true);
+				default:
+					return false;
+			}
+		}
+
+		// position of a key along the sparse dim (or NA)
+		template<typename Tind>
+		index_t sparse_position(Tind key)
+		{
+			if ( isNA(key) )
+				return NA<index_t>();
+			index_t pos;
+			switch(TYPEOF(domain())) {
+				case INTSXP: {
+					int * d = INTEGER(domain());
+					pos = std::lower_bound(d, d + sparse_extent(), key) - d;
+					if ( pos < sparse_extent() && d[pos] == key )
+						return pos;
+					return NA<index_t>();
+				}
+				case REALSXP: {
+					double * d = REAL(domain());
+					pos = std::lower_bound(d, d + sparse_extent(), key) - d;
+					if ( pos < sparse_extent() && d[pos] == key )
+						return pos;
+					return NA<index_t>();
+				}
+				default:
+					pos = static_cast<index_t>(key) - offset();
+					if ( pos < 0 || pos >= sparse_extent() )
+						return NA<index_t>();
+					if ( static_cast<Tind>(pos + offset()) != key )
+						return NA<index_t>();
+					return pos;
+			}
+		}
+
+		// call f(row, col, value) for each stored element that
+		// a dense read would return (the first of any duplicates)
+		template<typename Tind, typename F>
+		void for_nonzeros(F f)
+		{
+			std::vector<index_t> order;
+			read_slabs<Tind,double>(dense_extent(),
+				[&](index_t k) { return k; },
+				[&](index_t k, SparseSlab<Tind,double> & slab, index_t s) {
+					Tind * pj = slab.index_ptr(s);
+					double * px = slab.data_ptr(s);
+					index_t n = slab.nnz(s);
+					order.resize(n);
+					for ( index_t q = 0; q < n; q++ )
+						order[q] = q;
+					if ( !is_sorted(pj, n) )
+						std::stable_sort(order.begin(), order.end(),
+							[&](index_t a, index_t b) { return pj[a] < pj[b]; });
+					for ( index_t q = 0; q < n; q++ )
+					{
+						index_t o = order[q];
+						if ( q > 0 && pj[o] == pj[order[q - 1]] )
+							continue;
+						index_t pos = sparse_position<Tind>(pj[o]);
+						if ( isNA(pos) )
+							continue;
+						if ( is_transposed() )
+							f(k, pos, px[o]);
+						else
+							f(pos, k, px[o]);
+					}
+				});
+		}
+
+		template<typename F>
+		void visit_nonzeros(F f)
+		{
+			switch(indextype()) {
+				case INTSXP:
+					for_nonzeros<int>(f);
+					break;
+				case REALSXP:
+					for_nonzeros<double>(f);
+					break;
+				default:
+					Rf_error("unsupported sparse index type");
+			}
+		}
+
+		//// Sparse kernels (visiting only the nonzeros)
+		// these return R_NilValue when they don't apply
+		// so the caller can fall back to a dense method
+
+		bool all_finite(SEXP y)
+		{
+			double * py = REAL(y);
+			for ( R_xlen_t k = 0; k < XLENGTH(y); k++ )
+				if ( !R_FINITE(py[k]) )
+					return false;
+			return true;
+		}
+
+		// x %*% y for a dense (double) matrix y
+		// (non-finite y would need the 0 * y terms)
+		SEXP rmatmul(SEXP y)
+		{
+			if ( !has_exact_nonzeros() || !all_finite(y) )
+				return R_NilValue;
+			if ( Rf_nrows(y) != ncol() )
+				Rf_error("non-conformable arguments");
+			SEXP ans;
+			index_t nr = nrow(), ny = Rf_nrows(y), k = Rf_ncols(y);
+			PROTECT(ans = Rf_allocMatrix(REALSXP, nr, k));
+			double * pans = REAL(ans);
+			double * py = REAL(y);
+			fill<double>(pans, nr * k, 0);
+			visit_nonzeros([&](index_t r, index_t c, double v) {
+				for ( index_t j = 0; j < k; j++ )
+					pans[j * nr + r] += v * py[j * ny + c];
+			});
+			UNPROTECT(1);
+			return ans;
+		}
+
+		// y %*% x for a dense (double) matrix y
+		SEXP lmatmul(SEXP y)
+		{
+			if ( !has_exact_nonzeros() || !all_finite(y) )
+				return R_NilValue;
+			if ( Rf_ncols(y) != nrow() )
+				Rf_error("non-conformable arguments");
+			SEXP ans;
+			index_t nc = ncol(), k = Rf_nrows(y);
+			PROTECT(ans = Rf_allocMatrix(REALSXP, k, nc));
+			double * pans = REAL(ans);
+			double * py = REAL(y);
+			fill<double>(pans, k * nc, 0);
+			visit_nonzeros([&](index_t r, index_t c, double v) {
+				for ( index_t j = 0; j < k; j++ )
+					pans[c * k + j] += py[r * k + j] * v;
+			});
+			UNPROTECT(1);
+			return ans;
+		}
+
+		// distances between the rows (margin = 1) or columns
+		// (margin = 2) of x and those of a dense (double) y,
+		// starting from the distances to zero and correcting
+		// them at the nonzeros (for additive metrics only)
+		SEXP dist(SEXP y, int margin, int metric, double p, SEXP weights)
+		{
+			if ( !has_exact_nonzeros() || metric == DIST_MAX || !all_finite(y) )
+				return R_NilValue;
+			index_t nx = margin == 1 ? nrow() : ncol();
+			index_t dim = margin == 1 ? ncol() : nrow();
+			index_t ny = margin == 1 ? Rf_nrows(y) : Rf_ncols(y);
+			if ( (margin == 1 ? Rf_ncols(y) : Rf_nrows(y)) != dim )
+				Rf_error("x and y must have equal number of %s",
+					margin == 1 ? "columns" : "rows");
+			double * py = REAL(y);
+			double * wts = Rf_isNull(weights) ? NULL : REAL(weights);
+			// element t of the j-th row or column of y
+			auto yelt = [&](index_t j, index_t t) {
+				return margin == 1 ? py[t * ny + j] : py[j * dim + t];
+			};
+			// terms over all of y (as if x were all zeros)
+			std::vector<double> base(ny, 0);
+			for ( index_t j = 0; j < ny; j++ )
+				for ( index_t t = 0; t < dim; t++ )
+				{
+					double w = wts != NULL ? wts[t] : 1;
+					base[j] += w * dist_term(std::fabs(yelt(j, t)), metric, p);
+				}
+			// accumulate the terms at the nonzeros of x separately from
+			// the part of 'base' they replace (to limit cancellation)
+			SEXP ans;
+			PROTECT(ans = Rf_allocMatrix(REALSXP, nx, ny));
+			double * pans = REAL(ans);
+			std::vector<double> replaced(nx * ny, 0);
+			fill<double>(pans, nx * ny, 0);
+			visit_nonzeros([&](index_t r, index_t c, double v) {
+				index_t i = margin == 1 ? r : c;
+				index_t t = margin == 1 ? c : r;
+				double w = wts != NULL ? wts[t] : 1;
+				for ( index_t j = 0; j < ny; j++ )
+				{
+					double yt = yelt(j, t);
+					pans[j * nx + i] += w * dist_term(std::fabs(v - yt), metric, p);
+					replaced[j * nx + i] += w * dist_term(std::fabs(yt), metric, p);
+				}
+			});
+			for ( index_t j = 0; j < ny; j++ )
+				for ( index_t i = 0; i < nx; i++ )
+					pans[j * nx + i] += max2(base[j] - replaced[j * nx + i], 0.0);
+			for ( index_t k = 0; k < nx * ny; k++ )
+				pans[k] = dist_final(pans[k], metric, p);
+			UNPROTECT(1);
+			return ans;
+		}
+
 };
 
 #endif // SPARSE
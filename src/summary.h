@@ -0,0 +1,482 @@
+#ifndef SUMMARY_STATS
+#define SUMMARY_STATS
+
+#include <vector>
+
+#include "matterDefines.h"
+#include "matter.h"
+#include "sparse.h"
+
+// number of elements read per block from matter/sparse matrices
+#define STATS_BLOCKSIZE 65536
+
+//// Summary statistics
+//----------------------
+
+// running state for one (margin, group) cell
+struct StatCell {
+	double n; // non-missing elements
+	double nna; // missing elements
+	double lo; // min / count of false
+	double hi; // max / count of true
+	long double sum; // sum / product
+	double mean;
+	double m2;
+};
+
+inline void stat_init(StatCell & c, int stat)
+{
+	c.n = 0;
+	c.nna = 0;
+	c.lo = R_PosInf;
+	c.hi = R_NegInf;
+	c.sum = stat == STAT_PROD ? 1 : 0;
+	c.mean = 0;
+	c.m2 = 0;
+	if ( stat == STAT_ANY || stat == STAT_ALL || stat == STAT_NNZ )
+		c.lo = c.hi = 0;
+}
+
+template<int S>
+inline void stat_update(StatCell & c, double x)
+{
+	c.n++;
+	switch(S) {
+		case STAT_MAX:
+		case STAT_MIN:
+		case STAT_RANGE:
+			c.lo = x < c.lo ? x : c.lo;
+			c.hi = x > c.hi ? x : c.hi;
+			break;
+		case STAT_PROD:
+			c.sum *= x;
+			break;
+		case STAT_SUM:
+		case STAT_MEAN:
+			c.sum += x;
+			break;
+		case STAT_ANY:
+		case STAT_ALL:
+		case STAT_NNZ:
+			if ( x != 0 )
+				c.hi++;
+			else
+				c.lo++;
+			break;
+		case STAT_VAR:
+		case STAT_SD: {
+			// Welford's single-pass update
+			double d = x - c.mean;
+			c.mean += d / c.n;
+			c.m2 += d * (x - c.mean);
+			break;
+		}
+	}
+}
+
+// accumulate a column-major nr x nc block starting at (i0, j0)
+// where 'group' (1-based, may be NA) indexes the non-margin dim
+template<int S, typename T>
+void stat_block(std::vector<StatCell> & cells, T * x,
+	size_t nr, size_t nc, size_t i0, size_t j0,
+	int margin, size_t n, int * group)
+{
+	for ( size_t j = 0; j < nc; j++ )
+	{
+		for ( size_t i = 0; i < nr; i++ )
+		{
+			size_t k = margin == 1 ? i0 + i : j0 + j;
+			if ( group != NULL )
+			{
+				int g = margin == 1 ? group[j0 + j] : group[i0 + i];
+				if ( isNA(g) )
+					continue;
+				k += (g - 1) * n;
+			}
+			T xi = x[j * nr + i];
+			if ( isNA(xi) )
+				cells[k].nna++;
+			else
+				stat_update<S>(cells[k], static_cast<double>(xi));
+		}
+	}
+}
+
+template<typename T>
+void do_stat_block(std::vector<StatCell> & cells, int stat, T * x,
+	size_t nr, size_t nc, size_t i0, size_t j0,
+	int margin, size_t n, int * group)
+{
+	switch(stat) {
+		case STAT_MAX:
+		case STAT_MIN:
+		case STAT_RANGE:
+			stat_block<STAT_RANGE>(cells, x, nr, nc, i0, j0, margin, n, group);
+			break;
+		case STAT_PROD:
+			stat_block<STAT_PROD>(cells, x, nr, nc, i0, j0, margin, n, group);
+			break;
+		case STAT_SUM:
+		case STAT_MEAN:
+			stat_block<STAT_SUM>(cells, x, nr, nc, i0, j0, margin, n, group);
+			break;
+		case STAT_ANY:
+		case STAT_ALL:
+		case STAT_NNZ:
+			stat_block<STAT_NNZ>(cells, x, nr, nc, i0, j0, margin, n, group);
+			break;
+		case STAT_VAR:
+		case STAT_SD:
+			stat_block<STAT_VAR>(cells, x, nr, nc, i0, j0, margin, n, group);
+			break;
+		default:
+			Rf_error("unsupported statistic");
+	}
+}
+
+// account for z implicit zeros (e.g., of a sparse matrix)
+inline void stat_zeros(StatCell & c, int stat, double z)
+{
+	if ( z <= 0 )
+		return;
+	switch(stat) {
+		case STAT_MAX:
+		case STAT_MIN:
+		case STAT_RANGE:
+			c.lo = c.lo < 0 ? c.lo : 0;
+			c.hi = c.hi > 0 ? c.hi : 0;
+			break;
+		case STAT_PROD:
+			c.sum = 0;
+			break;
+		case STAT_ANY:
+		case STAT_ALL:
+		case STAT_NNZ:
+			c.lo += z;
+			break;
+		case STAT_VAR:
+		case STAT_SD: {
+			// merge with a group of z zeros
+			double n = c.n + z;
+			double d = -c.mean;
+			c.m2 += d * d * c.n * z / n;
+			c.mean += d * z / n;
+			break;
+		}
+	}
+	c.n += z;
+}
+
+// final value of a cell (following R's NA rules)
+inline double stat_value(const StatCell & c, int stat, bool na_rm)
+{
+	bool na = !na_rm && c.nna > 0;
+	switch(stat) {
+		case STAT_MAX:
+			return na ? NA_REAL : c.hi;
+		case STAT_MIN:
+			return na ? NA_REAL : c.lo;
+		case STAT_PROD:
+		case STAT_SUM:
+			return na ? NA_REAL : static_cast<double>(c.sum);
+		case STAT_MEAN:
+			return na ? NA_REAL : static_cast<double>(c.sum / c.n);
+		case STAT_ANY:
+			if ( c.hi > 0 )
+				return TRUE;
+			return na ? NA_LOGICAL : FALSE;
+		case STAT_ALL:
+			if ( c.lo > 0 )
+				return FALSE;
+			return na ? NA_LOGICAL : TRUE;
+		case STAT_NNZ:
+			return na ? NA_REAL : c.hi;
+		case STAT_VAR:
+			return (na || c.n < 2) ? NA_REAL : c.m2 / (c.n - 1);
+		case STAT_SD:
+			return (na || c.n < 2) ? NA_REAL : std::sqrt(c.m2 / (c.n - 1));
+		default:
+			return NA_REAL;
+	}
+}
+
+// mean of a cell (for the 'mean' attribute of var and sd)
+inline double stat_mean(const StatCell & c, bool na_rm)
+{
+	if ( !na_rm && c.nna > 0 )
+		return NA_REAL;
+	return c.n > 0 ? c.mean : R_NaN;
+}
+
+//// Matrix summaries
+//--------------------
+
+// summarize the rows (margin = 1) or columns (margin = 2)
+// of an R matrix, a matter_mat, or a sparse_mat in one pass,
+// returning list(value, nobs, mean) where cells are laid
+// out as a column-major n x ngroups matrix
+class MatrixStats {
+
+	public:
+
+		MatrixStats(int stat, int margin, SEXP group, int ngroups, bool na_rm)
+			: _stat(stat), _margin(margin), _ngroups(ngroups), _na_rm(na_rm)
+		{
+			_group = Rf_isNull(group) ? NULL : INTEGER(group);
+			_glen = Rf_isNull(group) ? 0 : XLENGTH(group);
+			if ( _group == NULL )
+				_ngroups = 1;
+			if ( _stat < STAT_MAX || _stat > STAT_NNZ )
+				Rf_error("unsupported statistic");
+			if ( _group != NULL && _stat == STAT_RANGE )
+				Rf_error("'range' stat not allowed with non-NULL group");
+		}
+
+		SEXP summarize(SEXP x)
+		{
+			if ( is_Rclass(x, "sparse_mat") ) {
+				SparseMatrix xm(x);
+				init(xm.nrow(), xm.ncol());
+				if ( xm.has_exact_nonzeros() ) {
+					update_sparse(xm);
+					return result();
+				}
+				switch(xm.datatype()) {
+					case INTSXP:
+						read_blocks<int>(xm, xm.is_transposed());
+						break;
+					case REALSXP:
+						read_blocks<double>(xm, xm.is_transposed());
+						break;
+					default:
+						Rf_error("unsupported sparse data type");
+				}
+			}
+			else if ( is_Rclass(x, "matter_mat") ) {
+				MatterMatrix xm(x);
+				init(xm.nrow(), xm.ncol());
+				read_blocks<double>(xm, xm.is_transposed());
+			}
+			else {
+				if ( TYPEOF(x) != LGLSXP && TYPEOF(x) != INTSXP && TYPEOF(x) != REALSXP )
+					Rf_error("unsupported data type");
+				init(Rf_nrows(x), Rf_ncols(x));
+				switch(TYPEOF(x)) {
+					case LGLSXP:
+						update(LOGICAL(x), _nr, _nc, 0, 0);
+						break;
+					case INTSXP:
+						update(INTEGER(x), _nr, _nc, 0, 0);
+						break;
+					case REALSXP:
+						update(REAL(x), _nr, _nc, 0, 0);
+						break;
+					default:
+						Rf_error("unsupported data type");
+				}
+			}
+			return result();
+		}
+
+	protected:
+
+		void init(size_t nr, size_t nc)
+		{
+			_nr = nr;
+			_nc = nc;
+			_n = _margin == 1 ? nr : nc;
+			if ( _group != NULL )
+			{
+				size_t ext = _margin == 1 ? nc : nr;
+				if ( _glen != ext )
+					Rf_error("length of groups [%d] does not match extent [%d]",
+						static_cast<int>(_glen), static_cast<int>(ext));
+				for ( size_t k = 0; k < _glen; k++ )
+					if ( !isNA(_group[k]) && (_group[k] < 1 || _group[k] > _ngroups) )
+						Rf_error("group codes must be between 1 and %d", _ngroups);
+			}
+			_cells.resize(_n * _ngroups);
+			for ( size_t k = 0; k < _cells.size(); k++ )
+				stat_init(_cells[k], _stat);
+		}
+
+		template<typename T>
+		void update(T * x, size_t nr, size_t nc, size_t i0, size_t j0)
+		{
+			do_stat_block(_cells, _stat, x, nr, nc, i0, j0,
+				_margin, _n, _group);
+		}
+
+		// visit only the nonzeros then add the implicit zeros
+		void update_sparse(SparseMatrix & xm)
+		{
+			std::vector<double> seen(_cells.size(), 0);
+			xm.visit_nonzeros([&](index_t r, index_t c, double v) {
+				size_t k = _margin == 1 ? r : c;
+				if ( _group != NULL )
+				{
+					int g = _margin == 1 ? _group[c] : _group[r];
+					if ( isNA(g) )
+						return;
+					k += (g - 1) * _n;
+				}
+				seen[k]++;
+				if ( isNA(v) )
+					_cells[k].nna++;
+				else
+					update_cell(_cells[k], v);
+			});
+			// number of elements in each group
+			size_t ext = _margin == 1 ? _nc : _nr;
+			std::vector<double> gsize(_ngroups, 0);
+			for ( size_t k = 0; k < ext; k++ )
+			{
+				if ( _group == NULL )
+					gsize[0]++;
+				else if ( !isNA(_group[k]) )
+					gsize[_group[k] - 1]++;
+			}
+			for ( size_t k = 0; k < _cells.size(); k++ )
+				stat_zeros(_cells[k], _stat, gsize[k / _n] - seen[k]);
+		}
+
+		void update_cell(StatCell & c, double x)
+		{
+			switch(_stat) {
+				case STAT_MAX:
+				case STAT_MIN:
+				case STAT_RANGE:
+					stat_update<STAT_RANGE>(c, x);
+					break;
+				case STAT_PROD:
+					stat_update<STAT_PROD>(c, x);
+					break;
+				case STAT_SUM:
+				case STAT_MEAN:
+					stat_update<STAT_SUM>(c, x);
+					break;
+				case STAT_ANY:
+				case STAT_ALL:
+				case STAT_NNZ:
+					stat_update<STAT_NNZ>(c, x);
+					break;
+				case STAT_VAR:
+				case STAT_SD:
+					stat_update<STAT_VAR>(c, x);
+					break;
+			}
+		}
+
+		// read blocks of whole columns (or whole rows if by_row)
+		// so that storage is traversed in its native order
+		template<typename T, class M>
+		void read_blocks(M & xm, bool by_row)
+		{
+			size_t len = by_row ? _nc : _nr;
+			size_t ext = by_row ? _nr : _nc;
+			size_t bs = len > 0 ? STATS_BLOCKSIZE / len : 0;
+			bs = bs > 0 ? bs : 1;
+			std::vector<T> buffer(len * bs);
+			SEXP indx;
+			for ( size_t k = 0; k < ext; k += bs )
+			{
+				size_t nk = (k + bs) < ext ? bs : (ext - k);
+				PROTECT(indx = index_seq(k, nk));
+				if ( by_row ) {
+					get_block<T>(xm, indx, R_NilValue, buffer.data());
+					update(buffer.data(), nk, _nc, k, 0);
+				}
+				else {
+					get_block<T>(xm, R_NilValue, indx, buffer.data());
+					update(buffer.data(), _nr, nk, 0, k);
+				}
+				UNPROTECT(1);
+			}
+		}
+
+		template<typename T>
+		void get_block(MatterMatrix & xm, SEXP i, SEXP j, T * buffer)
+		{
+			xm.get_submatrix<T>(i, j, buffer);
+		}
+
+		template<typename T>
+		void get_block(SparseMatrix & xm, SEXP i, SEXP j, T * buffer)
+		{
+			if ( xm.indextype() == INTSXP )
+				xm.get_submatrix<int,T>(i, j, buffer);
+			else
+				xm.get_submatrix<double,T>(i, j, buffer);
+		}
+
+		// 1-based subscripts from + 1 to from + n
+		SEXP index_seq(size_t from, size_t n)
+		{
+			SEXP indx = Rf_allocVector(REALSXP, n);
+			for ( size_t k = 0; k < n; k++ )
+				REAL(indx)[k] = from + k + 1;
+			return indx;
+		}
+
+		SEXP result()
+		{
+			SEXP value, nobs, mean, ans;
+			size_t ncells = _cells.size();
+			if ( _stat == STAT_RANGE ) {
+				PROTECT(value = Rf_allocMatrix(REALSXP, ncells, 2));
+				PROTECT(nobs = Rf_allocVector(REALSXP, 2 * ncells));
+			}
+			else {
+				if ( _stat == STAT_ANY || _stat == STAT_ALL )
+					PROTECT(value = Rf_allocVector(LGLSXP, ncells));
+				else
+					PROTECT(value = Rf_allocVector(REALSXP, ncells));
+				PROTECT(nobs = Rf_allocVector(REALSXP, ncells));
+			}
+			if ( _stat == STAT_VAR || _stat == STAT_SD )
+				PROTECT(mean = Rf_allocVector(REALSXP, ncells));
+			else
+				PROTECT(mean = R_NilValue);
+			for ( size_t k = 0; k < ncells; k++ )
+			{
+				const StatCell & c = _cells[k];
+				double nk = _na_rm ? c.n : c.n + c.nna;
+				switch(_stat) {
+					case STAT_RANGE:
+						REAL(value)[k] = stat_value(c, STAT_MIN, _na_rm);
+						REAL(value)[ncells + k] = stat_value(c, STAT_MAX, _na_rm);
+						REAL(nobs)[k] = nk;
+						REAL(nobs)[ncells + k] = nk;
+						break;
+					case STAT_ANY:
+					case STAT_ALL:
+						LOGICAL(value)[k] = stat_value(c, _stat, _na_rm);
+						REAL(nobs)[k] = nk;
+						break;
+					default:
+						REAL(value)[k] = stat_value(c, _stat, _na_rm);
+						REAL(nobs)[k] = nk;
+				}
+				if ( !Rf_isNull(mean) )
+					REAL(mean)[k] = stat_mean(c, _na_rm);
+			}
+			PROTECT(ans = Rf_allocVector(VECSXP, 3));
+			SET_VECTOR_ELT(ans, 0, value);
+			SET_VECTOR_ELT(ans, 1, nobs);
+			SET_VECTOR_ELT(ans, 2, mean);
+			UNPROTECT(4);
+			return ans;
+		}
+
+		int _stat;
+		int _margin;
+		int _ngroups;
+		bool _na_rm;
+		int * _group;
+		size_t _glen;
+		size_t _nr, _nc, _n;
+		std::vector<StatCell> _cells;
+
+};
+
+#endif // SUMMARY_STATS
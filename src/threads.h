@@ -0,0 +1,56 @@
+#ifndef THREADS
+#define THREADS
+
+#include <thread>
+#include <vector>
+#include <system_error>
+#include <cstddef>
+
+// minimum bytes per thread before spawning workers
+#define THREADS_MINBYTES 1048576
+
+//// Worker threads
+//------------------
+
+// NOTE: work run off the main thread must NOT
+// call the R API (no allocation, errors, warnings,
+// or interrupt checks); prepare all R-dependent
+// state on the main thread before and after
+
+// run fn(k) for k = 0, ..., n - 1 concurrently
+// (the calling thread runs k = 0 itself, and any
+// worker that can't be spawned is run inline)
+template<typename F>
+void run_threads(int n, F fn)
+{
+	std::vector<std::thread> workers;
+	std::vector<int> inline_ids;
+	for ( int k = 1; k < n; k++ )
+	{
+		try {
+			workers.emplace_back(fn, k);
+		}
+		catch ( const std::system_error & e ) {
+			inline_ids.push_back(k);
+		}
+	}
+	fn(0);
+	for ( size_t i = 0; i < inline_ids.size(); i++ )
+		fn(inline_ids[i]);
+	for ( size_t i = 0; i < workers.size(); i++ )
+		workers[i].join();
+}
+
+// run fn(i0, i1) concurrently over nthreads contiguous bands
+// [i0, i1) of the range 0, ..., n - 1 (e.g., image columns)
+template<typename F>
+void run_bands(int nthreads, ptrdiff_t n, F fn)
+{
+	run_threads(nthreads, [&](int k) {
+		ptrdiff_t i0 = (n * k) / nthreads;
+		ptrdiff_t i1 = (n * (k + 1)) / nthreads;
+		fn(i0, i1);
+	});
+}
+
+#endif // THREADS
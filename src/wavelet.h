@@ -0,0 +1,467 @@
+#ifndef WAVELET
+#define WAVELET
+
+#include <algorithm>
+#include <vector>
+
+#include "matterDefines.h"
+#include "fft.h"
+#include "threads.h"
+#include "filters.h"
+#include "signal.h"
+
+//// Continuous wavelet transform
+//--------------------------------
+
+// CWT of signals of length nx by FFT cross-correlation with
+// wavelets sampled at each scale (a list of double vectors);
+// the FFT plan and wavelet spectra are computed once and
+// reused for every scale and every signal
+class CWT {
+
+	public:
+
+		CWT(size_t nx, SEXP wavelets) : _nx(nx), _ns(LENGTH(wavelets))
+		{
+			size_t nwmax = 0;
+			for ( size_t i = 0; i < _ns; i++ )
+			{
+				SEXP w = VECTOR_ELT(wavelets, i);
+				if ( TYPEOF(w) != REALSXP )
+					Rf_error("wavelets must be double vectors");
+				size_t nw = XLENGTH(w);
+				nwmax = nw > nwmax ? nw : nwmax;
+			}
+			_plan = FFTPlan((nx > 0 ? nx - 1 : 0) + nwmax);
+			_n = _plan.length();
+			_spectra.assign(_ns * _n, complex_t(0, 0));
+			for ( size_t i = 0; i < _ns; i++ )
+			{
+				SEXP w = VECTOR_ELT(wavelets, i);
+				size_t nw = XLENGTH(w);
+				complex_t * s = _spectra.data() + i * _n;
+				for ( size_t k = 0; k < nw; k++ )
+					s[k] = REAL(w)[k];
+				_plan.transform(s);
+				for ( size_t k = 0; k < _n; k++ )
+					s[k] = std::conj(s[k]);
+				// center the coefficients on the wavelet
+				_shifts.push_back(nw / 2);
+			}
+		}
+
+		size_t nscales() const {
+			return _ns;
+		}
+
+		// length of the (zero-padded) transforms
+		size_t length() const {
+			return _n;
+		}
+
+		// coefficients of x at each scale (a column-major nx x ns
+		// matrix); 'work' must hold 2 * length() values
+		void transform(double * x, double * coefs, complex_t * work) const
+		{
+			complex_t * y = work;
+			complex_t * z = work + _n;
+			for ( size_t k = 0; k < _n; k++ )
+				y[k] = k < _nx ? x[k] : 0;
+			_plan.transform(y);
+			// the products of spectra of real signals are
+			// Hermitian so their inverses are real; pack two
+			// scales into the real and imaginary parts of
+			// each inverse transform
+			for ( size_t i = 0; i < _ns; i += 2 )
+			{
+				const complex_t * s1 = _spectra.data() + i * _n;
+				if ( i + 1 < _ns ) {
+					const complex_t * s2 = s1 + _n;
+					for ( size_t k = 0; k < _n; k++ )
+						z[k] = y[k] * s1[k] + complex_t(0, 1) * (y[k] * s2[k]);
+				}
+				else {
+					for ( size_t k = 0; k < _n; k++ )
+						z[k] = y[k] * s1[k];
+				}
+				_plan.transform(z, true);
+				for ( size_t j = i; j < i + 2 && j < _ns; j++ )
+				{
+					double * c = coefs + j * _nx;
+					size_t h = _shifts[j];
+					for ( size_t k = 0; k < _nx; k++ )
+					{
+						complex_t zk = z[(k + _n - h) % _n];
+						c[k] = (j == i ? zk.real() : zk.imag()) / _n;
+					}
+				}
+			}
+		}
+
+	protected:
+
+		size_t _nx, _ns, _n;
+		FFTPlan _plan;
+		std::vector<complex_t> _spectra;
+		std::vector<size_t> _shifts;
+
+};
+
+//// Ridge lines
+//---------------
+
+// a ridge line of (row, col) points
+struct Ridge {
+	std::vector<int> rows;
+	std::vector<int> cols;
+};
+
+// connect local maxima of the columns of a column-major
+// nr x nc matrix x into ridge lines, starting from the
+// highest column with maxima and proceeding toward the
+// lowest, matching each ridge to the nearest maximum within
+// maxdists[col] and removing ridges with more than ngaps gaps;
+// ridges are returned from lowest column to highest,
+// sorted by their row at the lowest column
+template<typename T>
+void find_ridges(T * x, size_t nr, size_t nc, const double * maxdists,
+	int ngaps, int * maxs, std::vector<Ridge> & out)
+{
+	int start = -1;
+	for ( size_t j = 0; j < nc; j++ )
+		if ( local_maxima(x + j * nr, nr, maxs + j * nr) > 0 )
+			start = j;
+	if ( start < 0 )
+		return;
+	std::vector<Ridge> ridges;
+	std::vector<int> gaps, rows;
+	for ( size_t i = 0; i < nr; i++ )
+	{
+		if ( maxs[start * nr + i] ) {
+			Ridge ridge;
+			ridge.rows.push_back(i);
+			ridge.cols.push_back(start);
+			ridges.push_back(ridge);
+			gaps.push_back(0);
+		}
+	}
+	for ( int col = start - 1; col >= 0; col-- )
+	{
+		rows.clear();
+		for ( size_t i = 0; i < nr; i++ )
+			if ( maxs[col * nr + i] )
+				rows.push_back(i);
+		// connect existing ridges
+		std::vector<bool> matched(rows.size(), false);
+		for ( size_t r = 0; r < ridges.size(); r++ )
+		{
+			gaps[r]++;
+			index_t m = binary_search(ridges[r].rows.back(), rows.data(),
+				0, rows.size(), maxdists[col], ABS_DIFF, NA_INTEGER);
+			if ( m != NA_INTEGER ) {
+				ridges[r].rows.push_back(rows[m]);
+				ridges[r].cols.push_back(col);
+				gaps[r] = 0;
+				matched[m] = true;
+			}
+		}
+		// start new ridges at unmatched maxima
+		for ( size_t m = 0; m < rows.size(); m++ )
+		{
+			if ( !matched[m] ) {
+				Ridge ridge;
+				ridge.rows.push_back(rows[m]);
+				ridge.cols.push_back(col);
+				ridges.push_back(ridge);
+				gaps.push_back(0);
+			}
+		}
+		// save and remove ridges with large gaps
+		size_t nkeep = 0;
+		for ( size_t r = 0; r < ridges.size(); r++ )
+		{
+			if ( gaps[r] > ngaps )
+				out.push_back(ridges[r]);
+			else {
+				if ( nkeep != r ) {
+					ridges[nkeep] = ridges[r];
+					gaps[nkeep] = gaps[r];
+				}
+				nkeep++;
+			}
+		}
+		ridges.resize(nkeep);
+		gaps.resize(nkeep);
+	}
+	out.insert(out.end(), ridges.begin(), ridges.end());
+	for ( size_t r = 0; r < out.size(); r++ )
+	{
+		std::reverse(out[r].rows.begin(), out[r].rows.end());
+		std::reverse(out[r].cols.begin(), out[r].cols.end());
+	}
+	std::stable_sort(out.begin(), out.end(),
+		[](const Ridge & a, const Ridge & b) {
+			return a.rows[0] < b.rows[0];
+		});
+}
+
+//// CWT peak detection
+//----------------------
+
+// peaks (0-based) with their SNR and boundaries, and
+// ridges with cols 0 = signal, 1, ..., ns = scales
+struct CWTPeaks {
+	std::vector<int> peaks;
+	std::vector<double> snr;
+	std::vector<int> left_bounds;
+	std::vector<int> right_bounds;
+	std::vector<Ridge> ridges;
+};
+
+// find peaks from the ridge lines of the CWT coefficients
+// (with the signal itself as the lowest column), keeping
+// ridges at least ridgelen long with a SNR >= snr, where the
+// noise is a rolling quantile of the smallest scale;
+// 'params' holds: ngaps, ridgelen, snr, qnoise, width, bounds
+class CWTPeakFinder {
+
+	public:
+
+		CWTPeakFinder(size_t nx, SEXP wavelets, SEXP maxdists, SEXP params)
+			: _nx(nx), _cwt(nx, wavelets)
+		{
+			size_t ns = _cwt.nscales();
+			_maxdists.push_back(1);
+			for ( size_t i = 0; i < ns; i++ )
+				_maxdists.push_back(REAL(maxdists)[i % LENGTH(maxdists)]);
+			if ( LENGTH(params) < 6 )
+				Rf_error("wrong number of parameters");
+			_ngaps = static_cast<int>(REAL(params)[0]);
+			_ridgelen = static_cast<size_t>(REAL(params)[1]);
+			_snr = REAL(params)[2];
+			_qnoise = REAL(params)[3];
+			_width = static_cast<int>(REAL(params)[4]);
+			_width = _width > 5 ? _width : 5;
+			_bounds = REAL(params)[5] != 0;
+		}
+
+		// per-thread buffers
+		class Workspace {
+
+			public:
+
+				Workspace(const CWTPeakFinder & f)
+				{
+					size_t nc = f._cwt.nscales() + 1;
+					coefs.resize(f._nx * nc);
+					maxs.resize(f._nx * nc);
+					work.resize(2 * f._cwt.length());
+					noise.resize(f._nx);
+					quant.resize(f._nx);
+				}
+
+				std::vector<double> coefs;
+				std::vector<int> maxs;
+				std::vector<complex_t> work;
+				std::vector<double> noise;
+				std::vector<double> quant;
+
+		};
+
+		// no R API calls, so it can be run off the main thread
+		void find(double * x, CWTPeaks & out, Workspace & ws) const
+		{
+			size_t nc = _cwt.nscales() + 1;
+			double * coefs = ws.coefs.data();
+			std::copy(x, x + _nx, coefs);
+			_cwt.transform(x, coefs + _nx, ws.work.data());
+			find_ridges(coefs, _nx, nc, _maxdists.data(),
+				_ngaps, ws.maxs.data(), out.ridges);
+			if ( nc > 1 )
+				for ( size_t i = 0; i < _nx; i++ )
+					ws.noise[i] = std::fabs(coefs[_nx + i]);
+			index_t halfwidth = _width / 2;
+			size_t nkeep = 0;
+			for ( size_t r = 0; r < out.ridges.size(); r++ )
+			{
+				Ridge & ridge = out.ridges[r];
+				// filter based on ridge length and duplicates
+				if ( ridge.rows.size() < _ridgelen )
+					continue;
+				int peak = ridge.rows[0];
+				if ( !out.peaks.empty() && out.peaks.back() == peak )
+					continue;
+				out.peaks.push_back(peak);
+				// get signal-to-noise ratio
+				double signal = R_NegInf, noise = NA_REAL;
+				for ( size_t k = 0; k < ridge.rows.size(); k++ )
+				{
+					if ( ridge.cols[k] > 0 ) {
+						double s = coefs[ridge.cols[k] * _nx + ridge.rows[k]];
+						signal = s > signal ? s : signal;
+					}
+				}
+				if ( nc > 1 ) {
+					index_t i = peak - halfwidth, j = peak + halfwidth;
+					index_t last = _nx - 1;
+					i = i > 0 ? i : 0;
+					j = j < last ? j : last;
+					noise = do_quant(ws.noise.data(), i, j, _qnoise, ws.quant.data());
+				}
+				out.snr.push_back(signal / noise);
+				if ( nkeep != r )
+					out.ridges[nkeep] = ridge;
+				nkeep++;
+			}
+			out.ridges.resize(nkeep);
+			// filter based on SNR
+			nkeep = 0;
+			for ( size_t p = 0; p < out.peaks.size(); p++ )
+			{
+				if ( out.snr[p] >= _snr ) {
+					out.peaks[nkeep] = out.peaks[p];
+					out.snr[nkeep] = out.snr[p];
+					if ( nkeep != p )
+						out.ridges[nkeep] = out.ridges[p];
+					nkeep++;
+				}
+			}
+			out.peaks.resize(nkeep);
+			out.snr.resize(nkeep);
+			out.ridges.resize(nkeep);
+			if ( _bounds ) {
+				// find peak boundaries (nearest local minima)
+				for ( size_t p = 0; p < out.peaks.size(); p++ )
+				{
+					out.left_bounds.push_back(peak_lbound(x, out.peaks[p], _nx));
+					out.right_bounds.push_back(peak_rbound(x, out.peaks[p], _nx));
+				}
+			}
+		}
+
+		// 1-based peaks with attributes 'snr', bounds (if requested),
+		// and 'ridges' (if requested) as 2-column matrices
+		SEXP peaks_sexp(CWTPeaks & p, bool ridges = true) const
+		{
+			size_t np = p.peaks.size();
+			SEXP peaks, snr, lbounds, rbounds, rlist, ri;
+			PROTECT(peaks = Rf_allocVector(INTSXP, np));
+			PROTECT(snr = Rf_allocVector(REALSXP, np));
+			for ( size_t k = 0; k < np; k++ )
+			{
+				INTEGER(peaks)[k] = p.peaks[k] + 1;
+				REAL(snr)[k] = p.snr[k];
+			}
+			if ( ridges ) {
+				PROTECT(rlist = Rf_allocVector(VECSXP, np));
+				for ( size_t k = 0; k < np; k++ )
+				{
+					size_t len = p.ridges[k].rows.size();
+					ri = Rf_allocMatrix(INTSXP, len, 2);
+					SET_VECTOR_ELT(rlist, k, ri);
+					for ( size_t i = 0; i < len; i++ )
+					{
+						INTEGER(ri)[i] = p.ridges[k].rows[i] + 1;
+						INTEGER(ri)[len + i] = p.ridges[k].cols[i];
+					}
+				}
+				Rf_setAttrib(peaks, Rf_install("ridges"), rlist);
+				UNPROTECT(1);
+			}
+			Rf_setAttrib(peaks, Rf_install("snr"), snr);
+			if ( _bounds ) {
+				PROTECT(lbounds = Rf_allocVector(INTSXP, np));
+				PROTECT(rbounds = Rf_allocVector(INTSXP, np));
+				for ( size_t k = 0; k < np; k++ )
+				{
+					INTEGER(lbounds)[k] = p.left_bounds[k] + 1;
+					INTEGER(rbounds)[k] = p.right_bounds[k] + 1;
+				}
+				Rf_setAttrib(peaks, Rf_install("left_bounds"), lbounds);
+				Rf_setAttrib(peaks, Rf_install("right_bounds"), rbounds);
+				UNPROTECT(2);
+			}
+			UNPROTECT(2);
+			return peaks;
+		}
+
+	protected:
+
+		size_t _nx;
+		CWT _cwt;
+		std::vector<double> _maxdists;
+		int _ngaps;
+		size_t _ridgelen;
+		double _snr;
+		double _qnoise;
+		int _width;
+		bool _bounds;
+
+};
+
+// find CWT peaks in the rows (margin = 1) or columns (margin = 2)
+// of a matrix, sharing the wavelet spectra across all signals
+// and detecting peaks in the signals of each block concurrently
+class MatrixPeaksCWT : public MatrixSignals {
+
+	public:
+
+		MatrixPeaksCWT(int margin, SEXP wavelets, SEXP maxdists,
+			SEXP params, int nthreads) : MatrixSignals(margin),
+			_wavelets(wavelets), _maxdists(maxdists), _params(params),
+			_nthreads(nthreads > 1 ? nthreads : 1), _finder(NULL) {}
+
+		~MatrixPeaksCWT() {
+			delete _finder;
+		}
+
+		// a list of peaks for each signal
+		SEXP apply(SEXP x)
+		{
+			if ( !read_signals(x) )
+				Rf_error("user interrupt");
+			SEXP result;
+			PROTECT(result = Rf_allocVector(VECSXP, _peaks.size()));
+			for ( size_t k = 0; k < _peaks.size(); k++ )
+			{
+				SET_VECTOR_ELT(result, k, _finder->peaks_sexp(_peaks[k], false));
+				_peaks[k] = CWTPeaks();
+			}
+			UNPROTECT(1);
+			return result;
+		}
+
+	protected:
+
+		void process_block(double * x, SEXP indx,
+			size_t from, size_t nk, size_t len)
+		{
+			if ( !_finder )
+				_finder = new CWTPeakFinder(len, _wavelets, _maxdists, _params);
+			_peaks.resize(from + nk);
+			int nthreads = _nthreads;
+			if ( nk < static_cast<size_t>(nthreads) )
+				nthreads = nk;
+			run_threads(nthreads, [&](int id) {
+				CWTPeakFinder::Workspace ws(*_finder);
+				for ( size_t k = id; k < nk; k += nthreads )
+				{
+					CWTPeaks & p = _peaks[from + k];
+					_finder->find(x + k * len, p, ws);
+					// ridges aren't returned so drop them early
+					p.ridges.clear();
+					p.ridges.shrink_to_fit();
+				}
+			});
+		}
+
+		SEXP _wavelets;
+		SEXP _maxdists;
+		SEXP _params;
+		int _nthreads;
+		CWTPeakFinder * _finder;
+		std::vector<CWTPeaks> _peaks;
+
+};
+
+#endif // WAVELET